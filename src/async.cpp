@@ -0,0 +1,237 @@
+// Set and map algebra on a background thread, for callers on the event loop
+// that can't afford to stall every other fiber while a large union runs.
+//
+// The calling fiber gives a job to one of Janet's threaded calls and waits.
+// The job holds copies of its arguments, so the tries it reads stay alive
+// even if their abstracts are collected in the meantime. Only the trie work
+// happens on the other thread: the result is wrapped in an abstract, and its
+// hash derived, back on the event loop.
+//
+// The other thread shares nodes with this one, so this needs atomic reference
+// counts. It also hashes elements there, while other fibers keep running
+// here. Hash caches are atomic, so that's safe for everything but abstract
+// types from other libraries, so the other thread looks for those first, and
+// if it finds one, it hands the job back to be run here. Without
+// JIMMY_THREAD_SAFE, or without an event loop, the async functions always do
+// the same work synchronously.
+
+#if defined(JIMMY_THREAD_SAFE) && defined(JANET_EV)
+#define JIMMY_ASYNC
+#endif
+
+typedef enum {
+  ASYNC_UNION,
+  ASYNC_INTERSECTION,
+  ASYNC_DIFFERENCE,
+  ASYNC_MERGE,
+} AsyncOp;
+
+typedef struct {
+  AsyncOp op;
+  // Sets from smallest to largest, except that the minuend of a difference
+  // comes first. Maps in argument order.
+  std::vector<Set> sets;
+  std::vector<Map> maps;
+  // The hash of the argument that the result is derived from.
+  HashCache base_hash;
+  bool track_hash;
+  uint32_t added;
+  uint32_t removed;
+  // Set by the other thread if the job has to run on this one.
+  bool handed_back;
+  Set set_result;
+  Map map_result;
+} AsyncJob;
+
+template <typename T>
+static std::vector<T *> async_pointers(std::vector<T> &values, size_t start) {
+  std::vector<T *> pointers;
+  for (size_t i = start; i < values.size(); i++) {
+    pointers.push_back(&values[i]);
+  }
+  return pointers;
+}
+
+static void async_run(AsyncJob *job) {
+  switch (job->op) {
+  case ASYNC_UNION:
+    job->set_result = set_union_of(async_pointers(job->sets, 0), job->track_hash, &job->added);
+    break;
+  case ASYNC_INTERSECTION:
+    job->set_result = set_intersection_of(async_pointers(job->sets, 0), job->track_hash, &job->removed);
+    break;
+  case ASYNC_DIFFERENCE:
+    job->set_result = set_difference_of(job->sets[0], async_pointers(job->sets, 1), &job->track_hash, &job->removed);
+    break;
+  case ASYNC_MERGE: {
+    MapHashDelta delta = { job->track_hash, 0, 0 };
+    job->map_result = map_merge_of(async_pointers(job->maps, 0), delta);
+    job->added = delta.added;
+    job->removed = delta.removed;
+    break;
+  }
+  }
+}
+
+// Wraps the result and frees the job.
+static Janet async_finish(AsyncJob *job) {
+  Janet result;
+  if (job->op == ASYNC_MERGE) {
+    auto map = NEW_MAP();
+    *map = job->map_result;
+    map_derive_hash_from(job->base_hash, map, job->added, job->removed);
+    result = janet_wrap_abstract(map);
+  } else {
+    auto set = NEW_SET();
+    *set = job->set_result;
+    if (job->track_hash) {
+      set_derive_hash_from(job->base_hash, set, job->added, job->removed);
+    }
+    result = janet_wrap_abstract(set);
+  }
+  delete job;
+  return result;
+}
+
+#ifdef JIMMY_ASYNC
+static bool async_thread_safe(const AsyncJob *job) {
+  for (const auto &set : job->sets) {
+    for (auto el : set) {
+      if (!hash_is_thread_safe(el)) {
+        return false;
+      }
+    }
+  }
+  // Merging hashes keys, and tracking the hash of the result hashes values.
+  for (const auto &map : job->maps) {
+    for (const auto &entry : map) {
+      if (!hash_is_thread_safe(entry.first) || !hash_is_thread_safe(entry.second)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static JanetEVGenericMessage async_work(JanetEVGenericMessage message) {
+  auto job = static_cast<AsyncJob *>(message.argp);
+  if (async_thread_safe(job)) {
+    async_run(job);
+  } else {
+    job->handed_back = true;
+  }
+  return message;
+}
+
+static void async_done(JanetEVGenericMessage message) {
+  auto job = static_cast<AsyncJob *>(message.argp);
+  if (job->handed_back) {
+    async_run(job);
+  }
+  Janet result = async_finish(job);
+  janet_gcunroot(janet_wrap_fiber(message.fiber));
+  if (janet_fiber_can_resume(message.fiber)) {
+    janet_schedule(message.fiber, result);
+  }
+}
+#endif
+
+// Takes ownership of `job`.
+static Janet async_start(AsyncJob *job) {
+#ifdef JIMMY_ASYNC
+  JanetEVGenericMessage message;
+  message.tag = 0;
+  message.argi = 0;
+  message.argp = job;
+  message.argj = janet_wrap_nil();
+  message.fiber = janet_root_fiber();
+  janet_gcroot(janet_wrap_fiber(message.fiber));
+  janet_ev_threaded_call(async_work, message, async_done);
+  janet_await();
+#else
+  async_run(job);
+  return async_finish(job);
+#endif
+}
+
+static AsyncJob *async_set_job(AsyncOp op, const std::vector<Set *> &sets, HashCache base_hash) {
+  auto job = new AsyncJob();
+  job->op = op;
+  for (auto set : sets) {
+    job->sets.push_back(*set);
+  }
+  job->base_hash = base_hash;
+  job->track_hash = base_hash.valid;
+  return job;
+}
+
+// Suspending the fiber unwinds the C stack without running destructors, so
+// the functions below build their jobs in an inner scope.
+
+static Janet cfun_set_union_async(int32_t argc, Janet *argv) {
+  if (argc == 0) {
+    return janet_wrap_abstract(NEW_SET());
+  }
+  AsyncJob *job;
+  {
+    auto sets = sets_by_size(argc, argv, 0);
+    job = async_set_job(ASYNC_UNION, sets, CAST_SET_BOX(sets.back())->hash);
+  }
+  return async_start(job);
+}
+
+static Janet cfun_set_intersection_async(int32_t argc, Janet *argv) {
+  if (argc == 0) {
+    return janet_wrap_abstract(NEW_SET());
+  }
+  AsyncJob *job;
+  {
+    auto sets = sets_by_size(argc, argv, 0);
+    job = async_set_job(ASYNC_INTERSECTION, sets, CAST_SET_BOX(sets.front())->hash);
+  }
+  return async_start(job);
+}
+
+static Janet cfun_set_difference_async(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto first_set = CAST_SET(janet_getabstract(argv, 0, &set_type));
+  AsyncJob *job;
+  {
+    auto sets = sets_by_size(argc, argv, 1);
+    sets.insert(sets.begin(), first_set);
+    job = async_set_job(ASYNC_DIFFERENCE, sets, CAST_SET_BOX(first_set)->hash);
+  }
+  return async_start(job);
+}
+
+static Janet cfun_map_merge_async(int32_t argc, Janet *argv) {
+  for (int32_t i = 0; i < argc; i++) {
+    janet_getabstract(argv, i, &map_type);
+  }
+  if (argc == 0) {
+    return janet_wrap_abstract(NEW_MAP());
+  }
+  auto job = new AsyncJob();
+  job->op = ASYNC_MERGE;
+  for (int32_t i = 0; i < argc; i++) {
+    job->maps.push_back(*CAST_MAP(janet_unwrap_abstract(argv[i])));
+  }
+  job->base_hash = CAST_MAP_BOX(janet_unwrap_abstract(argv[0]))->hash;
+  job->track_hash = job->base_hash.valid;
+  return async_start(job);
+}
+
+static const JanetReg async_cfuns[] = {
+  {"set/union-async", cfun_set_union_async, "(set/union-async & sets)\n\n"
+    "Like `set/union`, but computes the result on a background thread, and suspends the current fiber until it's done, "
+    "so other fibers on the event loop keep running. "
+    "This only uses a background thread if jimmy was built with `JIMMY_THREAD_SAFE`, and if none of the sets contain abstract types from other libraries with their own hash functions; "
+    "otherwise it's the same as `set/union`."},
+  {"set/intersection-async", cfun_set_intersection_async, "(set/intersection-async & sets)\n\n"
+    "Like `set/intersection`, but computes the result on a background thread. See `set/union-async`."},
+  {"set/difference-async", cfun_set_difference_async, "(set/difference-async set & sets)\n\n"
+    "Like `set/difference`, but computes the result on a background thread. See `set/union-async`."},
+  {"map/merge-async", cfun_map_merge_async, "(map/merge-async & maps)\n\n"
+    "Like `map/merge`, but computes the result on a background thread. See `set/union-async`."},
+  {NULL, NULL, NULL}
+};
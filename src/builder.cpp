@@ -0,0 +1,388 @@
+// Builders are transients that Janet code can hold on to: they edit their
+// nodes in place, without copying paths or allocating a new abstract for
+// every change, until `persistent!` freezes them into an ordinary immutable
+// collection. Freezing is O(1), and it retires the builder, because the
+// frozen collection shares the builder's nodes.
+//
+// A builder made from an existing collection edits a copy of it: nodes are
+// only copied the first time the builder touches them. Until then they're
+// shared with the original, so builders mark by node, like collections do,
+// and skip the nodes that have already been marked.
+
+template <typename T>
+struct Builder {
+  T transient;
+  bool frozen;
+};
+
+typedef Builder<TSet> SetBuilder;
+typedef Builder<TVec> VecBuilder;
+typedef Builder<TMap> MapBuilder;
+
+#define CAST_SET_BUILDER(expr) static_cast<SetBuilder *>((expr))
+#define CAST_VEC_BUILDER(expr) static_cast<VecBuilder *>((expr))
+#define CAST_MAP_BUILDER(expr) static_cast<MapBuilder *>((expr))
+
+template <typename T>
+static int builder_gc(void *data, size_t len) {
+  (void) len;
+  static_cast<Builder<T> *>(data)->~Builder();
+  return 0;
+}
+
+template <typename T>
+static T *builder_get(const Janet *argv, int32_t n, const JanetAbstractType *type) {
+  auto builder = static_cast<Builder<T> *>(janet_getabstract(argv, n, type));
+  if (builder->frozen) {
+    janet_panicf("%v has already been made persistent", argv[n]);
+  }
+  return &builder->transient;
+}
+
+template <typename T>
+static void builder_tostring(void *data, JanetBuffer *buffer) {
+  auto builder = static_cast<Builder<T> *>(data);
+  if (builder->frozen) {
+    janet_buffer_push_cstring(buffer, "frozen");
+  } else {
+    janet_buffer_push_cstring(buffer, "size ");
+    janet_pretty(buffer, 0, 0, janet_wrap_number(static_cast<double>(builder->transient.size())));
+  }
+}
+
+template <typename T>
+static Janet cfun_builder_length(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto builder = static_cast<Builder<T> *>(janet_unwrap_abstract(argv[0]));
+  return janet_wrap_number(builder->frozen ? 0 : static_cast<double>(builder->transient.size()));
+}
+
+// Sets
+
+static int set_builder_gcmark(void *data, size_t len) {
+  (void) len;
+  auto builder = CAST_SET_BUILDER(data);
+  if (!builder->frozen) {
+    mark_champ_transient(builder->transient, [](const Janet &el) {
+      janet_mark(el);
+    });
+  }
+  return 0;
+}
+
+static const JanetMethod set_builder_methods[] = {
+  {"length", cfun_builder_length<TSet>},
+  {NULL, NULL}
+};
+
+static int set_builder_get(void *data, Janet key, Janet *out) {
+  auto builder = CAST_SET_BUILDER(data);
+  if (!builder->frozen && builder->transient.count(key)) {
+    *out = janet_wrap_true();
+    return 1;
+  }
+  if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), set_builder_methods, out);
+  }
+  return 0;
+}
+
+// `(put builder x true)` adds `x`, and `(put builder x false)` removes it.
+static void set_builder_put(void *data, Janet key, Janet value) {
+  auto builder = CAST_SET_BUILDER(data);
+  if (builder->frozen) {
+    janet_panicf("%v has already been made persistent", janet_wrap_abstract(data));
+  }
+  if (janet_truthy(value)) {
+    builder->transient.insert(key);
+  } else {
+    builder->transient.erase(key);
+  }
+}
+
+static const JanetAbstractType set_builder_type = {
+  .name = "jimmy/set-builder",
+  .gc = builder_gc<TSet>,
+  .gcmark = set_builder_gcmark,
+  .get = set_builder_get,
+  .put = set_builder_put,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = builder_tostring<TSet>,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+static Janet cfun_set_builder(int32_t argc, Janet *argv) {
+  janet_arity(argc, 0, 1);
+  const Set *set = argc == 0 ? NULL : CAST_SET(janet_getabstract(argv, 0, &set_type));
+  auto builder = new (janet_abstract(&set_builder_type, sizeof(SetBuilder))) SetBuilder();
+  builder->transient = set == NULL ? Set().transient() : set->transient();
+  return janet_wrap_abstract(builder);
+}
+
+static Janet cfun_set_add_bang(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto transient = builder_get<TSet>(argv, 0, &set_builder_type);
+  for (int32_t i = 1; i < argc; i++) {
+    transient->insert(argv[i]);
+  }
+  return argv[0];
+}
+
+static Janet cfun_set_remove_bang(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto transient = builder_get<TSet>(argv, 0, &set_builder_type);
+  for (int32_t i = 1; i < argc; i++) {
+    transient->erase(argv[i]);
+  }
+  return argv[0];
+}
+
+static Janet cfun_set_persistent_bang(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto transient = builder_get<TSet>(argv, 0, &set_builder_type);
+  auto set = NEW_SET();
+  *set = std::move(*transient).persistent();
+  CAST_SET_BUILDER(janet_unwrap_abstract(argv[0]))->frozen = true;
+  return janet_wrap_abstract(set);
+}
+
+// Vectors
+
+static int vec_builder_gcmark(void *data, size_t len) {
+  (void) len;
+  auto builder = CAST_VEC_BUILDER(data);
+  if (!builder->frozen) {
+    mark_vector_transient(builder->transient);
+  }
+  return 0;
+}
+
+static const JanetMethod vec_builder_methods[] = {
+  {"length", cfun_builder_length<TVec>},
+  {NULL, NULL}
+};
+
+static int vec_builder_get(void *data, Janet key, Janet *out) {
+  auto builder = CAST_VEC_BUILDER(data);
+  if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), vec_builder_methods, out);
+  }
+  if (builder->frozen || !janet_checksize(key)) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(janet_unwrap_number(key));
+  if (index >= builder->transient.size()) {
+    return 0;
+  }
+  *out = builder->transient[index];
+  return 1;
+}
+
+// Like `vec/put-in`, putting at index `(length builder)` appends.
+static void vec_builder_put(void *data, Janet key, Janet value) {
+  auto builder = CAST_VEC_BUILDER(data);
+  if (builder->frozen) {
+    janet_panicf("%v has already been made persistent", janet_wrap_abstract(data));
+  }
+  size_t size = builder->transient.size();
+  if (!janet_checksize(key) || static_cast<size_t>(janet_unwrap_number(key)) > size) {
+    janet_panicf("expected integer key in range [0, %d], got %v", size, key);
+  }
+  size_t index = static_cast<size_t>(janet_unwrap_number(key));
+  if (index == size) {
+    builder->transient.push_back(value);
+  } else {
+    builder->transient.set(index, value);
+  }
+}
+
+static const JanetAbstractType vec_builder_type = {
+  .name = "jimmy/vec-builder",
+  .gc = builder_gc<TVec>,
+  .gcmark = vec_builder_gcmark,
+  .get = vec_builder_get,
+  .put = vec_builder_put,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = builder_tostring<TVec>,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+static Janet cfun_vec_builder(int32_t argc, Janet *argv) {
+  janet_arity(argc, 0, 1);
+  const Vec *vec = argc == 0 ? NULL : CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  auto builder = new (janet_abstract(&vec_builder_type, sizeof(VecBuilder))) VecBuilder();
+  builder->transient = vec == NULL ? Vec().transient() : vec->transient();
+  return janet_wrap_abstract(builder);
+}
+
+static Janet cfun_vec_push_bang(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto transient = builder_get<TVec>(argv, 0, &vec_builder_type);
+  for (int32_t i = 1; i < argc; i++) {
+    transient->push_back(argv[i]);
+  }
+  return argv[0];
+}
+
+static Janet cfun_vec_pop_bang(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto transient = builder_get<TVec>(argv, 0, &vec_builder_type);
+  if (transient->size() > 0) {
+    transient->take(transient->size() - 1);
+  }
+  return argv[0];
+}
+
+static Janet cfun_vec_persistent_bang(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto transient = builder_get<TVec>(argv, 0, &vec_builder_type);
+  auto vec = NEW_VEC();
+  *vec = std::move(*transient).persistent();
+  CAST_VEC_BUILDER(janet_unwrap_abstract(argv[0]))->frozen = true;
+  return janet_wrap_abstract(vec);
+}
+
+// Maps
+
+static int map_builder_gcmark(void *data, size_t len) {
+  (void) len;
+  auto builder = CAST_MAP_BUILDER(data);
+  if (!builder->frozen) {
+    mark_champ_transient(builder->transient, [](const std::pair<Janet, Janet> &pair) {
+      janet_mark(pair.first);
+      janet_mark(pair.second);
+    });
+  }
+  return 0;
+}
+
+static const JanetMethod map_builder_methods[] = {
+  {"length", cfun_builder_length<TMap>},
+  {NULL, NULL}
+};
+
+static int map_builder_get(void *data, Janet key, Janet *out) {
+  auto builder = CAST_MAP_BUILDER(data);
+  if (!builder->frozen) {
+    const Janet *value = builder->transient.find(key);
+    if (value != NULL) {
+      *out = *value;
+      return 1;
+    }
+  }
+  if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), map_builder_methods, out);
+  }
+  return 0;
+}
+
+// Like a table, putting `nil` removes the key.
+static void map_builder_put(void *data, Janet key, Janet value) {
+  auto builder = CAST_MAP_BUILDER(data);
+  if (builder->frozen) {
+    janet_panicf("%v has already been made persistent", janet_wrap_abstract(data));
+  }
+  if (janet_checktype(value, JANET_NIL)) {
+    builder->transient.erase(key);
+  } else {
+    builder->transient.set(key, value);
+  }
+}
+
+static const JanetAbstractType map_builder_type = {
+  .name = "jimmy/map-builder",
+  .gc = builder_gc<TMap>,
+  .gcmark = map_builder_gcmark,
+  .get = map_builder_get,
+  .put = map_builder_put,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = builder_tostring<TMap>,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+static Janet cfun_map_builder(int32_t argc, Janet *argv) {
+  janet_arity(argc, 0, 1);
+  const Map *map = argc == 0 ? NULL : CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  auto builder = new (janet_abstract(&map_builder_type, sizeof(MapBuilder))) MapBuilder();
+  builder->transient = map == NULL ? Map().transient() : map->transient();
+  return janet_wrap_abstract(builder);
+}
+
+static Janet cfun_map_put_bang(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  if ((argc - 1) % 2 != 0) {
+    janet_panic("expected even number of key-value arguments");
+  }
+  auto transient = builder_get<TMap>(argv, 0, &map_builder_type);
+  for (int32_t i = 1; i < argc; i += 2) {
+    transient->set(argv[i], argv[i + 1]);
+  }
+  return argv[0];
+}
+
+static Janet cfun_map_remove_bang(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto transient = builder_get<TMap>(argv, 0, &map_builder_type);
+  for (int32_t i = 1; i < argc; i++) {
+    transient->erase(argv[i]);
+  }
+  return argv[0];
+}
+
+static Janet cfun_map_persistent_bang(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto transient = builder_get<TMap>(argv, 0, &map_builder_type);
+  auto map = NEW_MAP();
+  *map = std::move(*transient).persistent();
+  CAST_MAP_BUILDER(janet_unwrap_abstract(argv[0]))->frozen = true;
+  return janet_wrap_abstract(map);
+}
+
+static const JanetReg builder_cfuns[] = {
+  {"set/builder", cfun_set_builder, "(set/builder &opt set)\n\n"
+    "Returns a mutable builder for a new set, or for an edited copy of `set`. "
+    "Edit it with `set/add!`, `set/remove!` or `put`, and call `set/persistent!` to get the finished set. "
+    "Each edit happens in place, which is much cheaper than creating a new set for every change."},
+  {"set/add!", cfun_set_add_bang, "(set/add! builder & xs)\n\n"
+    "Adds every argument to the builder in place, and returns the builder."},
+  {"set/remove!", cfun_set_remove_bang, "(set/remove! builder & xs)\n\n"
+    "Removes every argument from the builder in place, and returns the builder."},
+  {"set/persistent!", cfun_set_persistent_bang, "(set/persistent! builder)\n\n"
+    "Returns a persistent set with the contents of the builder, in constant time. "
+    "The builder cannot be used afterwards."},
+  {"vec/builder", cfun_vec_builder, "(vec/builder &opt vec)\n\n"
+    "Returns a mutable builder for a new vector, or for an edited copy of `vec`. "
+    "Edit it with `vec/push!`, `vec/pop!` or `put`, and call `vec/persistent!` to get the finished vector. "
+    "Each edit happens in place, which is much cheaper than creating a new vector for every change."},
+  {"vec/push!", cfun_vec_push_bang, "(vec/push! builder & xs)\n\n"
+    "Appends every argument to the builder in place, and returns the builder."},
+  {"vec/pop!", cfun_vec_pop_bang, "(vec/pop! builder)\n\n"
+    "Removes the last element of the builder in place, and returns the builder."},
+  {"vec/persistent!", cfun_vec_persistent_bang, "(vec/persistent! builder)\n\n"
+    "Returns a persistent vector with the contents of the builder, in constant time. "
+    "The builder cannot be used afterwards."},
+  {"map/builder", cfun_map_builder, "(map/builder &opt map)\n\n"
+    "Returns a mutable builder for a new map, or for an edited copy of `map`. "
+    "Edit it with `map/put!`, `map/remove!` or `put`, and call `map/persistent!` to get the finished map. "
+    "Each edit happens in place, which is much cheaper than creating a new map for every change."},
+  {"map/put!", cfun_map_put_bang, "(map/put! builder & kvs)\n\n"
+    "Adds every key-value pair to the builder in place, and returns the builder."},
+  {"map/remove!", cfun_map_remove_bang, "(map/remove! builder & keys)\n\n"
+    "Removes every key from the builder in place, and returns the builder."},
+  {"map/persistent!", cfun_map_persistent_bang, "(map/persistent! builder)\n\n"
+    "Returns a persistent map with the contents of the builder, in constant time. "
+    "The builder cannot be used afterwards."},
+  {NULL, NULL, NULL}
+};
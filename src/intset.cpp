@@ -0,0 +1,886 @@
+#include <immer/box.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// A persistent set of unsigned 32-bit integers, stored like a roaring bitmap.
+// Elements are grouped into chunks by their high 16 bits, and each chunk
+// stores its low 16 bits in whichever container is smallest:
+//
+// - an array: the sorted values, for sparse chunks
+// - a bitmap: 1024 64-bit words, for dense chunks
+// - a run container: sorted pairs of (start, length - 1), for clustered ones
+//
+// Containers are immutable and reference counted, so two versions of an
+// intset share every chunk that neither of them changed. Set algebra works a
+// chunk at a time: chunks that only one side has, or that both sides share,
+// are reused as they are, and bitmaps are combined a whole word at a time.
+
+typedef enum {
+  IntArray,
+  IntBitmap,
+  IntRun,
+} IntContainerKind;
+
+typedef struct {
+  IntContainerKind kind;
+  uint32_t cardinality;
+  std::vector<uint16_t> values;
+  std::vector<uint64_t> words;
+} IntContainer;
+
+typedef immer::box<IntContainer, MemoryPolicy> IntBox;
+
+typedef struct {
+  uint16_t key;
+  IntBox container;
+} IntChunk;
+
+typedef immer::flex_vector<IntChunk, MemoryPolicy> IntSet;
+
+struct IntSetBox : IntSet {
+  HashCache hash;
+};
+
+#define CAST_INTSET_BOX(expr) static_cast<IntSetBox *>((expr))
+#define CAST_INTSET(expr) static_cast<IntSet *>(CAST_INTSET_BOX(expr))
+#define NEW_INTSET() CAST_INTSET(new (janet_abstract(&intset_type, sizeof(IntSetBox))) IntSetBox())
+
+static const uint32_t INT_ARRAY_MAX = 4096;
+static const size_t INT_WORDS = 1024;
+
+// Containers
+
+static bool operator==(const IntContainer &a, const IntContainer &b) {
+  // Every container is normalized, so the same values always produce the
+  // same representation.
+  return a.kind == b.kind && a.values == b.values && a.words == b.words;
+}
+
+// The smallest representation for `cardinality` values in `runs` runs.
+static IntContainerKind int_smallest_kind(size_t cardinality, size_t runs) {
+  size_t array_bytes = cardinality * 2;
+  size_t run_bytes = runs * 4;
+  size_t bitmap_bytes = INT_WORDS * 8;
+  if (run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+    return IntRun;
+  } else if (cardinality <= INT_ARRAY_MAX) {
+    return IntArray;
+  } else {
+    return IntBitmap;
+  }
+}
+
+// Picks the smallest representation for a set of sorted, distinct values.
+static IntContainer int_from_sorted(std::vector<uint16_t> values) {
+  IntContainer container;
+  container.cardinality = static_cast<uint32_t>(values.size());
+  size_t runs = values.empty() ? 0 : 1;
+  for (size_t i = 1; i < values.size(); i++) {
+    if (values[i] != values[i - 1] + 1) {
+      runs++;
+    }
+  }
+  container.kind = int_smallest_kind(values.size(), runs);
+  if (container.kind == IntRun) {
+    for (size_t i = 0; i < values.size(); i++) {
+      if (i == 0 || values[i] != values[i - 1] + 1) {
+        container.values.push_back(values[i]);
+        container.values.push_back(0);
+      } else {
+        container.values.back()++;
+      }
+    }
+  } else if (container.kind == IntArray) {
+    container.values = std::move(values);
+  } else {
+    container.words.assign(INT_WORDS, 0);
+    for (auto value : values) {
+      container.words[value >> 6] |= uint64_t(1) << (value & 63);
+    }
+  }
+  return container;
+}
+
+static uint32_t int_popcount(uint64_t word) {
+  return static_cast<uint32_t>(__builtin_popcountll(word));
+}
+
+static IntContainer int_from_words(std::vector<uint64_t> words) {
+  uint32_t cardinality = 0;
+  size_t runs = 0;
+  uint64_t carry = 0;
+  for (auto word : words) {
+    cardinality += int_popcount(word);
+    runs += int_popcount(word & ~((word << 1) | carry));
+    carry = word >> 63;
+  }
+  if (cardinality <= INT_ARRAY_MAX || runs * 4 < INT_WORDS * 8) {
+    std::vector<uint16_t> values;
+    values.reserve(cardinality);
+    for (size_t i = 0; i < words.size(); i++) {
+      for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+        values.push_back(static_cast<uint16_t>((i << 6) + __builtin_ctzll(word)));
+      }
+    }
+    return int_from_sorted(std::move(values));
+  }
+  IntContainer container;
+  container.kind = IntBitmap;
+  container.cardinality = cardinality;
+  container.words = std::move(words);
+  return container;
+}
+
+static void int_set_range(std::vector<uint64_t> &words, uint32_t start, uint32_t end) {
+  for (uint32_t i = start; i <= end;) {
+    if ((i & 63) == 0 && i + 63 <= end) {
+      words[i >> 6] = ~uint64_t(0);
+      i += 64;
+    } else {
+      words[i >> 6] |= uint64_t(1) << (i & 63);
+      i++;
+    }
+  }
+}
+
+static std::vector<uint64_t> int_to_words(const IntContainer &container) {
+  if (container.kind == IntBitmap) {
+    return container.words;
+  }
+  std::vector<uint64_t> words(INT_WORDS, 0);
+  if (container.kind == IntArray) {
+    for (auto value : container.values) {
+      words[value >> 6] |= uint64_t(1) << (value & 63);
+    }
+  } else {
+    for (size_t i = 0; i < container.values.size(); i += 2) {
+      uint32_t start = container.values[i];
+      int_set_range(words, start, start + container.values[i + 1]);
+    }
+  }
+  return words;
+}
+
+template <typename Fn>
+static void int_for_each(const IntContainer &container, Fn &&fn) {
+  switch (container.kind) {
+  case IntArray:
+    for (auto value : container.values) {
+      fn(value);
+    }
+    break;
+  case IntBitmap:
+    for (size_t i = 0; i < INT_WORDS; i++) {
+      for (uint64_t word = container.words[i]; word != 0; word &= word - 1) {
+        fn(static_cast<uint16_t>((i << 6) + __builtin_ctzll(word)));
+      }
+    }
+    break;
+  case IntRun:
+    for (size_t i = 0; i < container.values.size(); i += 2) {
+      uint32_t start = container.values[i];
+      uint32_t end = start + container.values[i + 1];
+      for (uint32_t value = start; value <= end; value++) {
+        fn(static_cast<uint16_t>(value));
+      }
+    }
+    break;
+  }
+}
+
+static std::vector<uint16_t> int_to_values(const IntContainer &container) {
+  if (container.kind == IntArray) {
+    return container.values;
+  }
+  std::vector<uint16_t> values;
+  values.reserve(container.cardinality);
+  int_for_each(container, [&](uint16_t value) { values.push_back(value); });
+  return values;
+}
+
+// Returns the smallest value in the container that is at least `from`, or -1.
+static int32_t int_lower_bound(const IntContainer &container, uint32_t from) {
+  switch (container.kind) {
+  case IntArray: {
+    auto it = std::lower_bound(container.values.begin(), container.values.end(), from);
+    return it == container.values.end() ? -1 : *it;
+  }
+  case IntBitmap:
+    for (size_t i = from >> 6; i < INT_WORDS; i++) {
+      uint64_t word = container.words[i];
+      if (i == (from >> 6)) {
+        word &= ~uint64_t(0) << (from & 63);
+      }
+      if (word != 0) {
+        return static_cast<int32_t>((i << 6) + __builtin_ctzll(word));
+      }
+    }
+    return -1;
+  case IntRun: {
+    // Find the first run that ends at or after `from`.
+    size_t low = 0;
+    size_t high = container.values.size() / 2;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (static_cast<uint32_t>(container.values[2 * mid]) + container.values[2 * mid + 1] < from) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (low == container.values.size() / 2) {
+      return -1;
+    }
+    uint32_t start = container.values[2 * low];
+    return static_cast<int32_t>(from < start ? start : from);
+  }
+  }
+  return -1;
+}
+
+static bool int_contains(const IntContainer &container, uint16_t value) {
+  switch (container.kind) {
+  case IntArray:
+    return std::binary_search(container.values.begin(), container.values.end(), value);
+  case IntBitmap:
+    return (container.words[value >> 6] >> (value & 63)) & 1;
+  case IntRun:
+    return int_lower_bound(container, value) == value;
+  }
+  return false;
+}
+
+static IntContainer int_union(const IntContainer &a, const IntContainer &b) {
+  if (a.kind != IntBitmap && b.kind != IntBitmap && a.cardinality + b.cardinality <= INT_ARRAY_MAX) {
+    auto a_values = int_to_values(a);
+    auto b_values = int_to_values(b);
+    std::vector<uint16_t> values;
+    std::set_union(a_values.begin(), a_values.end(), b_values.begin(), b_values.end(), std::back_inserter(values));
+    return int_from_sorted(std::move(values));
+  }
+  auto words = int_to_words(a);
+  auto other = int_to_words(b);
+  for (size_t i = 0; i < INT_WORDS; i++) {
+    words[i] |= other[i];
+  }
+  return int_from_words(std::move(words));
+}
+
+static IntContainer int_intersection(const IntContainer &a, const IntContainer &b) {
+  if (a.kind == IntArray || b.kind == IntArray) {
+    auto &small = a.kind == IntArray ? a : b;
+    auto &large = a.kind == IntArray ? b : a;
+    std::vector<uint16_t> values;
+    for (auto value : small.values) {
+      if (int_contains(large, value)) {
+        values.push_back(value);
+      }
+    }
+    return int_from_sorted(std::move(values));
+  }
+  auto words = int_to_words(a);
+  auto other = int_to_words(b);
+  for (size_t i = 0; i < INT_WORDS; i++) {
+    words[i] &= other[i];
+  }
+  return int_from_words(std::move(words));
+}
+
+static IntContainer int_difference(const IntContainer &a, const IntContainer &b) {
+  if (a.kind == IntArray) {
+    std::vector<uint16_t> values;
+    for (auto value : a.values) {
+      if (!int_contains(b, value)) {
+        values.push_back(value);
+      }
+    }
+    return int_from_sorted(std::move(values));
+  }
+  auto words = int_to_words(a);
+  auto other = int_to_words(b);
+  for (size_t i = 0; i < INT_WORDS; i++) {
+    words[i] &= ~other[i];
+  }
+  return int_from_words(std::move(words));
+}
+
+// Chunks
+
+static bool int_same_container(const IntChunk &a, const IntChunk &b) {
+  return &a.container.get() == &b.container.get();
+}
+
+// Returns the index of the first chunk whose key is at least `key`.
+static size_t intset_lower_bound(const IntSet &set, uint16_t key) {
+  size_t low = 0;
+  size_t high = set.size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (set[mid].key < key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static size_t intset_size(const IntSet &set) {
+  size_t size = 0;
+  for (auto &chunk : set) {
+    size += chunk.container->cardinality;
+  }
+  return size;
+}
+
+static bool intset_contains(const IntSet &set, uint32_t value) {
+  uint16_t key = static_cast<uint16_t>(value >> 16);
+  size_t index = intset_lower_bound(set, key);
+  return index < set.size() && set[index].key == key
+    && int_contains(*set[index].container, static_cast<uint16_t>(value & 0xffff));
+}
+
+typedef enum {
+  IntUnion,
+  IntIntersection,
+  IntDifference,
+} IntOperation;
+
+// Walks the chunks of both sets in order of their keys.
+static IntSet intset_combine(const IntSet &a, const IntSet &b, IntOperation op) {
+  auto transient = IntSet().transient();
+  auto push = [&](uint16_t key, IntContainer &&container) {
+    if (container.cardinality > 0) {
+      transient.push_back(IntChunk { key, IntBox(std::move(container)) });
+    }
+  };
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.size() || j < b.size()) {
+    if (j == b.size() || (i < a.size() && a[i].key < b[j].key)) {
+      if (op != IntIntersection) {
+        transient.push_back(a[i]);
+      }
+      i++;
+    } else if (i == a.size() || b[j].key < a[i].key) {
+      if (op == IntUnion) {
+        transient.push_back(b[j]);
+      }
+      j++;
+    } else {
+      auto &chunk_a = a[i];
+      auto &chunk_b = b[j];
+      if (int_same_container(chunk_a, chunk_b)) {
+        if (op != IntDifference) {
+          transient.push_back(chunk_a);
+        }
+      } else {
+        auto &ca = *chunk_a.container;
+        auto &cb = *chunk_b.container;
+        switch (op) {
+        case IntUnion: push(chunk_a.key, int_union(ca, cb)); break;
+        case IntIntersection: push(chunk_a.key, int_intersection(ca, cb)); break;
+        case IntDifference: push(chunk_a.key, int_difference(ca, cb)); break;
+        }
+      }
+      i++;
+      j++;
+    }
+  }
+  return transient.persistent();
+}
+
+// Builds a set from values that the caller has already validated.
+static IntSet intset_from_values(std::vector<uint32_t> values) {
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  auto transient = IntSet().transient();
+  size_t i = 0;
+  while (i < values.size()) {
+    uint16_t key = static_cast<uint16_t>(values[i] >> 16);
+    std::vector<uint16_t> low;
+    for (; i < values.size() && (values[i] >> 16) == key; i++) {
+      low.push_back(static_cast<uint16_t>(values[i] & 0xffff));
+    }
+    transient.push_back(IntChunk { key, IntBox(int_from_sorted(std::move(low))) });
+  }
+  return transient.persistent();
+}
+
+// Applies `op` to the chunks of `set` that `other` touches, leaving every
+// other chunk where it is. Used for small edits to large sets, where walking
+// every chunk would cost more than the edit itself.
+static IntSet intset_edit(const IntSet &set, const IntSet &other, IntOperation op) {
+  IntSet result = set;
+  for (auto &chunk : other) {
+    size_t index = intset_lower_bound(result, chunk.key);
+    bool found = index < result.size() && result[index].key == chunk.key;
+    if (!found) {
+      if (op == IntUnion) {
+        result = result.insert(index, chunk);
+      }
+      continue;
+    }
+    IntContainer container = op == IntUnion
+      ? int_union(*result[index].container, *chunk.container)
+      : int_difference(*result[index].container, *chunk.container);
+    if (container.cardinality == 0) {
+      result = result.erase(index);
+    } else {
+      result = result.set(index, IntChunk { chunk.key, IntBox(std::move(container)) });
+    }
+  }
+  return result;
+}
+
+// The abstract type
+
+static uint32_t intset_unwrap(Janet x) {
+  if (!janet_checktype(x, JANET_NUMBER)) {
+    janet_panicf("expected integer in range [0, 4294967295], got %v", x);
+  }
+  double number = janet_unwrap_number(x);
+  if (number < 0 || number > 4294967295.0 || number != std::floor(number)) {
+    janet_panicf("expected integer in range [0, 4294967295], got %v", x);
+  }
+  return static_cast<uint32_t>(number);
+}
+
+static int intset_gc(void *data, size_t len) {
+  (void) len;
+  CAST_INTSET_BOX(data)->~IntSetBox();
+  return 0;
+}
+
+template <typename Fn>
+static void intset_for_each(const IntSet &set, Fn &&fn) {
+  for (auto &chunk : set) {
+    uint32_t high = static_cast<uint32_t>(chunk.key) << 16;
+    int_for_each(*chunk.container, [&](uint16_t low) { fn(high | low); });
+  }
+}
+
+static void intset_tostring(void *data, JanetBuffer *buffer) {
+  auto set = CAST_INTSET(data);
+  janet_buffer_push_cstring(buffer, "{");
+  int first = 1;
+  intset_for_each(*set, [&](uint32_t value) {
+    if (first) {
+      first = 0;
+    } else {
+      janet_buffer_push_cstring(buffer, " ");
+    }
+    janet_pretty(buffer, 0, 0, janet_wrap_number(value));
+  });
+  janet_buffer_push_cstring(buffer, "}");
+}
+
+static Janet cfun_intset_length(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto set = CAST_INTSET(janet_unwrap_abstract(argv[0]));
+  return janet_wrap_number(static_cast<double>(intset_size(*set)));
+}
+
+static const JanetMethod intset_methods[] = {
+  {"length", cfun_intset_length},
+  {NULL, NULL}
+};
+
+// Iterating over an intset yields its elements in ascending order. The keys
+// that `next` hands out are the elements themselves, so `get` returns the key
+// if the set contains it.
+static int intset_get(void *data, Janet key, Janet *out) {
+  auto set = CAST_INTSET(data);
+  if (janet_checktype(key, JANET_NUMBER)) {
+    double number = janet_unwrap_number(key);
+    if (number >= 0 && number <= 4294967295.0 && number == std::floor(number)
+        && intset_contains(*set, static_cast<uint32_t>(number))) {
+      *out = key;
+      return 1;
+    }
+    return 0;
+  } else if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), intset_methods, out);
+  } else {
+    return 0;
+  }
+}
+
+static Janet intset_next(void *data, Janet key) {
+  auto set = CAST_INTSET(data);
+  uint64_t from = 0;
+  if (!janet_checktype(key, JANET_NIL)) {
+    from = static_cast<uint64_t>(intset_unwrap(key)) + 1;
+  }
+  for (size_t index = intset_lower_bound(*set, static_cast<uint16_t>(from >> 16));
+       from <= 0xffffffff && index < set->size(); index++) {
+    auto &chunk = (*set)[index];
+    uint32_t low = chunk.key == (from >> 16) ? static_cast<uint32_t>(from & 0xffff) : 0;
+    int32_t found = int_lower_bound(*chunk.container, low);
+    if (found >= 0) {
+      return janet_wrap_number((static_cast<uint32_t>(chunk.key) << 16) | static_cast<uint32_t>(found));
+    }
+  }
+  return janet_wrap_nil();
+}
+
+static Janet intset_call(void *data, int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  Janet out;
+  return janet_wrap_boolean(janet_checktype(argv[0], JANET_NUMBER) && intset_get(data, argv[0], &out));
+}
+
+static int intset_compare(void *data1, void *data2) {
+  auto set1 = CAST_INTSET(data1);
+  auto set2 = CAST_INTSET(data2);
+  if (!hashes_differ(CAST_INTSET_BOX(set1)->hash, CAST_INTSET_BOX(set2)->hash) && set1->size() == set2->size()) {
+    bool equal = true;
+    for (size_t i = 0; equal && i < set1->size(); i++) {
+      auto &chunk1 = (*set1)[i];
+      auto &chunk2 = (*set2)[i];
+      equal = chunk1.key == chunk2.key && (int_same_container(chunk1, chunk2) || *chunk1.container == *chunk2.container);
+    }
+    if (equal) {
+      return 0;
+    }
+  }
+  return set1 > set2 ? 1 : -1;
+}
+
+static int32_t intset_hash(void *data, size_t len) {
+  (void) len;
+  auto box = CAST_INTSET_BOX(data);
+  if (!box->hash.valid) {
+    uint32_t hash = 0x5e1ec7ed;
+    intset_for_each(*box, [&](uint32_t value) {
+      hash += hash_scramble(static_cast<int32_t>(value));
+    });
+    box->hash.value = hash;
+    box->hash.valid = true;
+  }
+  return static_cast<int32_t>(box->hash.value);
+}
+
+// Containers are marshaled as they are stored, with 16-bit values packed
+// four to a 64-bit integer.
+static void intset_marshal(void *data, JanetMarshalContext *ctx) {
+  janet_marshal_abstract(ctx, data);
+  auto set = CAST_INTSET(data);
+  janet_marshal_size(ctx, set->size());
+  for (auto &chunk : *set) {
+    auto &container = *chunk.container;
+    janet_marshal_int(ctx, chunk.key);
+    janet_marshal_int(ctx, container.kind);
+    janet_marshal_int(ctx, static_cast<int32_t>(container.cardinality));
+    if (container.kind == IntBitmap) {
+      for (auto word : container.words) {
+        janet_marshal_int64(ctx, static_cast<int64_t>(word));
+      }
+    } else {
+      janet_marshal_size(ctx, container.values.size());
+      for (size_t i = 0; i < container.values.size(); i += 4) {
+        uint64_t packed = 0;
+        for (size_t j = 0; j < 4 && i + j < container.values.size(); j++) {
+          packed |= static_cast<uint64_t>(container.values[i + j]) << (16 * j);
+        }
+        janet_marshal_int64(ctx, static_cast<int64_t>(packed));
+      }
+    }
+  }
+}
+
+[[noreturn]] static void intset_corrupt() {
+  janet_panic("invalid marshaled intset");
+}
+
+// Everything else in this file assumes that a container's values are in
+// order and in range, and equality assumes that every container is stored in
+// its smallest representation, so a container read from a marshaled intset
+// has to be exactly one that we could have written. Returns the number of
+// values in the container.
+static uint32_t int_check_values(IntContainerKind kind, const uint16_t *values, size_t count) {
+  size_t cardinality = 0;
+  size_t runs = 0;
+  if (kind == IntArray) {
+    for (size_t i = 0; i < count; i++) {
+      if (i > 0 && values[i] <= values[i - 1]) {
+        intset_corrupt();
+      }
+      if (i == 0 || values[i] != values[i - 1] + 1) {
+        runs++;
+      }
+    }
+    cardinality = count;
+  } else {
+    if (count % 2 != 0) {
+      intset_corrupt();
+    }
+    uint32_t previous_end = 0;
+    for (size_t i = 0; i < count; i += 2) {
+      uint32_t start = values[i];
+      uint32_t end = start + values[i + 1];
+      // Runs are in order, and never touch, or they'd be a single run.
+      if (end > UINT16_MAX || (i > 0 && start <= previous_end + 1)) {
+        intset_corrupt();
+      }
+      cardinality += end - start + 1;
+      previous_end = end;
+    }
+    runs = count / 2;
+  }
+  if (cardinality == 0 || int_smallest_kind(cardinality, runs) != kind) {
+    intset_corrupt();
+  }
+  return static_cast<uint32_t>(cardinality);
+}
+
+static uint32_t int_check_words(const uint64_t *words) {
+  size_t cardinality = 0;
+  size_t runs = 0;
+  uint64_t carry = 0;
+  for (size_t i = 0; i < INT_WORDS; i++) {
+    cardinality += int_popcount(words[i]);
+    runs += int_popcount(words[i] & ~((words[i] << 1) | carry));
+    carry = words[i] >> 63;
+  }
+  if (int_smallest_kind(cardinality, runs) != IntBitmap) {
+    intset_corrupt();
+  }
+  return static_cast<uint32_t>(cardinality);
+}
+
+// Panicking unwinds the stack without running destructors, so nothing read
+// from `ctx` is kept in a C++ object until it's all been read and checked.
+// Containers are read into fixed buffers first: no container we'd write holds
+// more than INT_ARRAY_MAX values or INT_WORDS words. Each finished chunk
+// goes straight into the abstract, which the GC frees if we panic later.
+static void *intset_unmarshal(JanetMarshalContext *ctx) {
+  auto set = CAST_INTSET(new (janet_unmarshal_abstract(ctx, sizeof(IntSetBox))) IntSetBox());
+  size_t chunks = janet_unmarshal_size(ctx);
+  if (chunks > UINT16_MAX + 1) {
+    intset_corrupt();
+  }
+  uint16_t values[INT_ARRAY_MAX];
+  uint64_t words[INT_WORDS];
+  int32_t previous_key = -1;
+  for (size_t i = 0; i < chunks; i++) {
+    int32_t key = janet_unmarshal_int(ctx);
+    int32_t kind = janet_unmarshal_int(ctx);
+    int32_t cardinality = janet_unmarshal_int(ctx);
+    if (key <= previous_key || key > UINT16_MAX) {
+      intset_corrupt();
+    }
+    previous_key = key;
+    size_t count = 0;
+    uint32_t actual;
+    if (kind == IntBitmap) {
+      for (size_t j = 0; j < INT_WORDS; j++) {
+        words[j] = static_cast<uint64_t>(janet_unmarshal_int64(ctx));
+      }
+      actual = int_check_words(words);
+    } else if (kind == IntArray || kind == IntRun) {
+      count = janet_unmarshal_size(ctx);
+      if (count > INT_ARRAY_MAX) {
+        intset_corrupt();
+      }
+      for (size_t j = 0; j < count; j += 4) {
+        uint64_t packed = static_cast<uint64_t>(janet_unmarshal_int64(ctx));
+        for (size_t k = 0; k < 4 && j + k < count; k++) {
+          values[j + k] = static_cast<uint16_t>(packed >> (16 * k));
+        }
+      }
+      actual = int_check_values(static_cast<IntContainerKind>(kind), values, count);
+    } else {
+      intset_corrupt();
+    }
+    if (static_cast<int64_t>(actual) != cardinality) {
+      intset_corrupt();
+    }
+    IntContainer container;
+    container.kind = static_cast<IntContainerKind>(kind);
+    container.cardinality = actual;
+    if (kind == IntBitmap) {
+      container.words.assign(words, words + INT_WORDS);
+    } else {
+      container.values.assign(values, values + count);
+    }
+    *set = set->push_back(IntChunk { static_cast<uint16_t>(key), IntBox(std::move(container)) });
+  }
+  return set;
+}
+
+static const JanetAbstractType intset_type = {
+  .name = "jimmy/intset",
+  .gc = intset_gc,
+  .gcmark = NULL,
+  .get = intset_get,
+  .put = NULL,
+  .marshal = intset_marshal,
+  .unmarshal = intset_unmarshal,
+  .tostring = intset_tostring,
+  .compare = intset_compare,
+  .hash = intset_hash,
+  .next = intset_next,
+  .call = intset_call,
+};
+
+// Functions
+
+static Janet intset_wrap(IntSet &&set) {
+  auto box = NEW_INTSET();
+  *box = std::move(set);
+  return janet_wrap_abstract(box);
+}
+
+static Janet cfun_intset_new(int32_t argc, Janet *argv) {
+  for (int32_t i = 0; i < argc; i++) {
+    intset_unwrap(argv[i]);
+  }
+  std::vector<uint32_t> values(argc);
+  for (int32_t i = 0; i < argc; i++) {
+    values[i] = intset_unwrap(argv[i]);
+  }
+  return intset_wrap(intset_from_values(std::move(values)));
+}
+
+static Janet cfun_intset_of(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  Janet iterable = argv[0];
+  if (janet_checkabstract(iterable, &intset_type)) {
+    return iterable;
+  }
+  // Copy the elements into a Janet array first, so that nothing can panic
+  // once we've started building C++ objects.
+  JanetArray *elements;
+  if (janet_checkabstract(iterable, &set_type)) {
+    auto set = CAST_SET(janet_unwrap_abstract(iterable));
+    elements = janet_array(static_cast<int32_t>(set->size()));
+    for (auto el : *set) {
+      janet_array_push(elements, el);
+    }
+  } else {
+    elements = janet_array(0);
+    Janet key = janet_wrap_nil();
+    while (true) {
+      key = janet_next(iterable, key);
+      if (janet_checktype(key, JANET_NIL)) {
+        break;
+      }
+      janet_array_push(elements, janet_in(iterable, key));
+    }
+  }
+  for (int32_t i = 0; i < elements->count; i++) {
+    intset_unwrap(elements->data[i]);
+  }
+  std::vector<uint32_t> values(elements->count);
+  for (int32_t i = 0; i < elements->count; i++) {
+    values[i] = intset_unwrap(elements->data[i]);
+  }
+  return intset_wrap(intset_from_values(std::move(values)));
+}
+
+static Janet intset_edit_cfun(int32_t argc, Janet *argv, IntOperation op) {
+  janet_arity(argc, 1, -1);
+  auto set = CAST_INTSET(janet_getabstract(argv, 0, &intset_type));
+  for (int32_t i = 1; i < argc; i++) {
+    intset_unwrap(argv[i]);
+  }
+  std::vector<uint32_t> values(argc - 1);
+  for (int32_t i = 1; i < argc; i++) {
+    values[i - 1] = intset_unwrap(argv[i]);
+  }
+  return intset_wrap(intset_edit(*set, intset_from_values(std::move(values)), op));
+}
+
+static Janet cfun_intset_add(int32_t argc, Janet *argv) {
+  return intset_edit_cfun(argc, argv, IntUnion);
+}
+
+static Janet cfun_intset_remove(int32_t argc, Janet *argv) {
+  return intset_edit_cfun(argc, argv, IntDifference);
+}
+
+static Janet intset_fold_cfun(int32_t argc, Janet *argv, int32_t min_args, IntOperation op) {
+  janet_arity(argc, min_args, -1);
+  for (int32_t i = 0; i < argc; i++) {
+    janet_getabstract(argv, i, &intset_type);
+  }
+  if (argc == 0) {
+    return intset_wrap(IntSet());
+  }
+  IntSet result = *CAST_INTSET(janet_unwrap_abstract(argv[0]));
+  for (int32_t i = 1; i < argc; i++) {
+    result = intset_combine(result, *CAST_INTSET(janet_unwrap_abstract(argv[i])), op);
+  }
+  return intset_wrap(std::move(result));
+}
+
+static Janet cfun_intset_union(int32_t argc, Janet *argv) {
+  return intset_fold_cfun(argc, argv, 0, IntUnion);
+}
+
+static Janet cfun_intset_intersection(int32_t argc, Janet *argv) {
+  return intset_fold_cfun(argc, argv, 0, IntIntersection);
+}
+
+static Janet cfun_intset_difference(int32_t argc, Janet *argv) {
+  return intset_fold_cfun(argc, argv, 1, IntDifference);
+}
+
+static JanetArray *intset_to_array(const IntSet &set) {
+  JanetArray *array = janet_array(static_cast<int32_t>(intset_size(set)));
+  intset_for_each(set, [&](uint32_t value) {
+    array->data[array->count++] = janet_wrap_number(value);
+  });
+  return array;
+}
+
+static JanetArray *set_intset_to_array(Janet source) {
+  if (!janet_checkabstract(source, &intset_type)) {
+    return NULL;
+  }
+  return intset_to_array(*CAST_INTSET(janet_unwrap_abstract(source)));
+}
+
+static Janet cfun_intset_to_array(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto set = CAST_INTSET(janet_getabstract(argv, 0, &intset_type));
+  return janet_wrap_array(intset_to_array(*set));
+}
+
+static Janet cfun_intset_to_set(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto intset = CAST_INTSET(janet_getabstract(argv, 0, &intset_type));
+  auto set = NEW_SET();
+  auto transient = set->transient();
+  intset_for_each(*intset, [&](uint32_t value) {
+    transient.insert(janet_wrap_number(value));
+  });
+  *set = transient.persistent();
+  return janet_wrap_abstract(set);
+}
+
+static const JanetReg intset_cfuns[] = {
+  {"intset/new", cfun_intset_new, "(intset/new & xs)\n\n"
+    "Returns a persistent immutable set of unsigned 32-bit integers containing only the listed elements. "
+    "Intsets store their elements in compressed bitmaps, so they take far less memory than sets of numbers, "
+    "and set algebra on them works many elements at a time."},
+  {"intset/of", cfun_intset_of, "(intset/of iterable)\n\n"
+    "Returns an intset of all the values in an iterable data structure, such as a jimmy set or an array."},
+  {"intset/add", cfun_intset_add, "(intset/add set & xs)\n\n"
+    "Returns a new intset containing all of the elements from the original set and all of the subsequent arguments."},
+  {"intset/remove", cfun_intset_remove, "(intset/remove set & xs)\n\n"
+    "Returns a new intset containing all of the elements from the original set except any of the subsequent arguments."},
+  {"intset/union", cfun_intset_union, "(intset/union & sets)\n\n"
+    "Returns an intset that is the union of all of its arguments."},
+  {"intset/intersection", cfun_intset_intersection, "(intset/intersection & sets)\n\n"
+    "Returns an intset that is the intersection of all of its arguments."},
+  {"intset/difference", cfun_intset_difference, "(intset/difference set & sets)\n\n"
+    "Returns an intset that is the first set minus all of the latter sets."},
+  {"intset/to-array", cfun_intset_to_array, "(intset/to-array set)\n\n"
+    "Returns an array of all of the elements in the intset, in ascending order."},
+  {"intset/to-set", cfun_intset_to_set, "(intset/to-set set)\n\n"
+    "Returns a jimmy set of all of the elements in the intset."},
+  {NULL, NULL, NULL}
+};
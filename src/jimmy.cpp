@@ -1,5 +1,10 @@
 #include <janet.h>
+#include <immer/algorithm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <vector>
 
 namespace std {
   template <> struct hash<Janet> {
@@ -23,6 +28,178 @@ static int32_t hash_mix(int32_t input, int32_t other) {
   return input ^ (other + 0b01111011101001001000000110110101 + (input << 6) + (input >> 2));
 }
 
+// Sets and maps combine the hashes of their elements by addition, so adding
+// or removing an element can update a cached hash without looking at the rest
+// of the collection. We scramble each element's hash first so that small
+// integers don't sum to each other.
+static uint32_t hash_scramble(int32_t input) {
+  uint32_t hash = static_cast<uint32_t>(input);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// Collections compute their hash the first time they're asked for it, and
+// keep it next to the immer value in their abstract. Set algebra can hash
+// the same collection on several threads at once, so both fields are atomic,
+// and writers store `value` before `valid`: a thread that sees `valid` also
+// sees the hash. Two threads might both compute the hash, but they'll store
+// the same value.
+struct HashCache {
+  std::atomic<uint32_t> value;
+  std::atomic<bool> valid;
+
+  HashCache() : value(0), valid(false) {}
+
+  HashCache(const HashCache &other) : value(0), valid(false) {
+    *this = other;
+  }
+
+  HashCache &operator=(const HashCache &other) {
+    bool other_valid = other.valid;
+    value = other.value.load();
+    valid = other_valid;
+    return *this;
+  }
+};
+
+// Jimmy's collections, and Janet's own values, can be hashed on any thread.
+// Abstract types from other libraries might do anything in their hash
+// functions, so we only call those on the thread that owns them. Returns
+// false if hashing `x` might call one. Defined at the end of this file, once
+// every type has been.
+static bool hash_is_thread_safe(Janet x);
+
+// If both hashes are known we can tell that two collections are different
+// without comparing their elements.
+static bool hashes_differ(const HashCache &a, const HashCache &b) {
+  return a.valid && b.valid && a.value != b.value;
+}
+
+// immer::diff walks two sets or two maps side by side, skipping every subtree
+// that they share by pointer. Two versions of the same collection share most
+// of their trie, so this costs time proportional to how much they differ,
+// rather than to their size. `added` sees values only in `b`, `removed` sees
+// values only in `a`, and `changed` sees map entries whose value changed.
+template <typename T, typename Added, typename Removed, typename Changed>
+static void structural_diff(const T &a, const T &b, Added &&added, Removed &&removed, Changed &&changed) {
+  immer::diff(a, b, immer::make_differ(added, removed, changed));
+}
+
+// Thrown to stop immer::diff early; see `structural_diff_within`.
+struct DiffLimitReached {};
+
+// Like structural_diff, but gives up as soon as `limit` values have been
+// added, removed or changed, and returns whether it got to the end first.
+// immer::diff has no way to stop, so we throw our way out of it.
+template <typename T, typename Added, typename Removed, typename Changed>
+static bool structural_diff_within(size_t limit, const T &a, const T &b, Added &&added, Removed &&removed, Changed &&changed) {
+  size_t count = 0;
+  auto counted = [&]() {
+    if (++count >= limit) {
+      throw DiffLimitReached();
+    }
+  };
+  if (limit == 0) {
+    return false;
+  }
+  try {
+    structural_diff(a, b,
+      [&](const typename T::value_type &x) { counted(); added(x); },
+      [&](const typename T::value_type &x) { counted(); removed(x); },
+      [&](const typename T::value_type &x, const typename T::value_type &y) { counted(); changed(x, y); });
+  } catch (const DiffLimitReached &) {
+    return false;
+  }
+  return true;
+}
+
+// Collections of similar size are worth diffing structurally: even when they
+// share nothing, a diff costs about as much as inserting the smaller one.
+// When one side is much smaller, it's cheaper to just iterate it.
+template <typename T>
+static bool similar_size(const T &a, const T &b) {
+  auto small = a.size() < b.size() ? a.size() : b.size();
+  auto large = a.size() < b.size() ? b.size() : a.size();
+  return large <= small * 4;
+}
+
+// Below this many elements, bulk loading isn't worth the sort. Building with
+// JIMMY_NO_BULK_LOAD turns it off, to compare; see bench/bulk.janet.
+#ifdef JIMMY_NO_BULK_LOAD
+static const size_t BULK_LOAD_MIN = SIZE_MAX;
+#else
+static const size_t BULK_LOAD_MIN = 64;
+#endif
+
+// CHAMP tries consume hash bits from the least significant end, so reversing
+// the bits of each hash gives a key whose sort order is the order of the
+// trie's leaves.
+static uint32_t trie_order(uint32_t hash) {
+  hash = ((hash >> 1) & 0x55555555) | ((hash & 0x55555555) << 1);
+  hash = ((hash >> 2) & 0x33333333) | ((hash & 0x33333333) << 2);
+  hash = ((hash >> 4) & 0x0f0f0f0f) | ((hash & 0x0f0f0f0f) << 4);
+  hash = ((hash >> 8) & 0x00ff00ff) | ((hash & 0x00ff00ff) << 8);
+  return (hash >> 16) | (hash << 16);
+}
+
+// Returns the offsets of `count` keys, `stride` Janets apart, in the order
+// that a set or map should insert them. Hashing everything up front and
+// inserting in trie order means that consecutive insertions into a transient
+// walk the same path from the root, which is still in cache and already owned
+// by the transient, instead of jumping around the whole trie. The transient
+// hashes each key again when it's inserted, but Janet caches the hash of
+// everything that's expensive to hash, so that's cheap.
+//
+// Duplicate keys are resolved here too: only the last occurrence of each key
+// survives, which is the one that repeated insertion would have kept. Sorting
+// by hash and then by position puts equal keys in the same run of equal
+// hashes, with later occurrences after earlier ones, so we walk each run
+// backwards and keep the keys we haven't seen yet. That compares each key with
+// the distinct keys in its run, which is usually one; a run of distinct keys
+// whose hashes collide ends up in a single collision node of the trie, which
+// costs as much to insert into.
+static std::vector<int32_t> bulk_load_order(const Janet *items, int32_t count, int32_t stride) {
+  std::vector<std::pair<uint32_t, int32_t>> keyed(count);
+  for (int32_t i = 0; i < count; i++) {
+    keyed[i] = std::make_pair(trie_order(static_cast<uint32_t>(janet_hash(items[i * stride]))), i * stride);
+  }
+  std::sort(keyed.begin(), keyed.end());
+  std::vector<int32_t> order;
+  order.reserve(count);
+  std::vector<int32_t> run;
+  for (size_t start = 0; start < keyed.size();) {
+    size_t end = start + 1;
+    while (end < keyed.size() && keyed[end].first == keyed[start].first) {
+      end++;
+    }
+    if (end - start == 1) {
+      order.push_back(keyed[start].second);
+    } else {
+      run.clear();
+      for (size_t i = end; i > start; i--) {
+        Janet key = items[keyed[i - 1].second];
+        bool seen = false;
+        for (auto offset : run) {
+          if (janet_equals(key, items[offset])) {
+            seen = true;
+            break;
+          }
+        }
+        if (!seen) {
+          run.push_back(keyed[i - 1].second);
+        }
+      }
+      order.insert(order.end(), run.rbegin(), run.rend());
+    }
+    start = end;
+  }
+  return order;
+}
+
 static Janet pair_to_tuple(std::pair<Janet, Janet> pair) {
   Janet *tuple = janet_tuple_begin(2);
   tuple[0] = pair.first;
@@ -68,19 +245,158 @@ static Janet call_callable(Janet callable, int32_t argc, Janet *argv) {
   }
 }
 
+// Runs `body`, and then `cleanup`. If `body` panics, `cleanup` still runs
+// before the panic continues. Panicking unwinds the C stack without running
+// destructors, so anything that has to be undone when a callback fails,
+// like a GC root or a buffer that the GC marks, belongs in `cleanup`.
+template <typename Body, typename Cleanup>
+static void with_cleanup(Body &&body, Cleanup &&cleanup) {
+  JanetTryState state;
+  if (janet_try(&state)) {
+    Janet error = state.payload;
+    janet_restore(&state);
+    cleanup();
+    janet_panicv(error);
+  }
+  body();
+  janet_restore(&state);
+  cleanup();
+}
+
+// Calls `f` with `first`, followed by the `count` values in `rest`, for
+// functions like `update`. call_callable hands its arguments straight to C
+// functions, which might trigger a collection, so they can't live in memory
+// that the GC might free: they go on the C stack, or if there are too many
+// of them, in a tuple that stays rooted for the duration of the call.
+static const int32_t CALL_STACK_ARGS = 8;
+
+static Janet call_with_first(Janet f, Janet first, const Janet *rest, int32_t count) {
+  if (count < CALL_STACK_ARGS) {
+    Janet args[CALL_STACK_ARGS];
+    args[0] = first;
+    std::copy(rest, rest + count, args + 1);
+    return call_callable(f, count + 1, args);
+  }
+  Janet *args = janet_tuple_begin(count + 1);
+  args[0] = first;
+  std::copy(rest, rest + count, args + 1);
+  Janet tuple = janet_wrap_tuple(janet_tuple_end(args));
+  Janet result;
+  janet_gcroot(tuple);
+  with_cleanup([&]() { result = call_callable(f, count + 1, args); }, [&]() { janet_gcunroot(tuple); });
+  return result;
+}
+
+#include "memory.cpp"
+#include "mark.cpp"
+#include "marshal.cpp"
 #include "set.cpp"
 #include "map.cpp"
+#include "async.cpp"
 #include "vec.cpp"
+#include "path.cpp"
+#include "xf.cpp"
+#include "view.cpp"
+#include "num.cpp"
+#include "intset.cpp"
+#include "sorted.cpp"
+#include "mapped.cpp"
+#include "builder.cpp"
+
+// Tuples and structs hash their elements when they're created, and abstracts
+// without a hash function hash by address. Numeric vectors and intsets only
+// hash numbers. Other jimmy collections only hash their contents until their
+// hash is cached, so we only have to look inside the ones that haven't been
+// hashed yet.
+static bool hash_is_thread_safe(Janet x) {
+  if (!janet_checktype(x, JANET_ABSTRACT)) {
+    return true;
+  }
+  void *abstract = janet_unwrap_abstract(x);
+  const JanetAbstractType *type = janet_abstract_type(abstract);
+  if (type->hash == NULL || type == &f64vec_type || type == &i64vec_type || type == &intset_type) {
+    return true;
+  }
+  if (type == &set_type) {
+    if (CAST_SET_BOX(abstract)->hash.valid) {
+      return true;
+    }
+    for (auto el : *CAST_SET(abstract)) {
+      if (!hash_is_thread_safe(el)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (type == &map_type) {
+    if (CAST_MAP_BOX(abstract)->hash.valid) {
+      return true;
+    }
+    for (const auto &entry : *CAST_MAP(abstract)) {
+      if (!hash_is_thread_safe(entry.first) || !hash_is_thread_safe(entry.second)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (type == &vec_type) {
+    if (CAST_VEC_BOX(abstract)->hash.valid) {
+      return true;
+    }
+    for (auto el : *CAST_VEC(abstract)) {
+      if (!hash_is_thread_safe(el)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (type == &sorted_set_type || type == &sorted_map_type) {
+    auto box = CAST_SORTED(abstract);
+    if (box->hash.valid) {
+      return true;
+    }
+    bool safe = true;
+    sorted_for_each(box->root, [&](const SortedNode *node) {
+      safe = safe && hash_is_thread_safe(node->key) && hash_is_thread_safe(node->value);
+    });
+    return safe;
+  }
+  return false;
+}
 
 JANET_MODULE_ENTRY(JanetTable *env) {
   janet_cfuns(env, "jimmy", set_cfuns);
   janet_cfuns(env, "jimmy", map_cfuns);
   janet_cfuns(env, "jimmy", vec_cfuns);
+  janet_cfuns(env, "jimmy", path_cfuns);
+  janet_cfuns(env, "jimmy", xf_cfuns);
+  janet_cfuns(env, "jimmy", view_cfuns);
+  janet_cfuns(env, "jimmy", num_cfuns);
+  janet_cfuns(env, "jimmy", intset_cfuns);
+  janet_cfuns(env, "jimmy", sorted_cfuns);
+  janet_cfuns(env, "jimmy", mapped_cfuns);
+  janet_cfuns(env, "jimmy", async_cfuns);
+  janet_cfuns(env, "jimmy", builder_cfuns);
+  janet_register_abstract_type(&marshal_sentinel_type);
   janet_register_abstract_type(&set_type);
   janet_register_abstract_type(&set_iterator_type);
   janet_register_abstract_type(&tset_type);
   janet_register_abstract_type(&map_type);
   janet_register_abstract_type(&map_iterator_type);
+  janet_register_abstract_type(&tmap_type);
   janet_register_abstract_type(&vec_type);
   janet_register_abstract_type(&tvec_type);
+  janet_register_abstract_type(&xf_step_type);
+  janet_register_abstract_type(&xf_run_type);
+  janet_register_abstract_type(&view_type);
+  janet_register_abstract_type(&f64vec_type);
+  janet_register_abstract_type(&i64vec_type);
+  janet_register_abstract_type(&intset_type);
+  janet_register_abstract_type(&sorted_set_type);
+  janet_register_abstract_type(&sorted_map_type);
+  janet_register_abstract_type(&mapped_set_type);
+  janet_register_abstract_type(&mapped_map_type);
+  janet_register_abstract_type(&set_builder_type);
+  janet_register_abstract_type(&vec_builder_type);
+  janet_register_abstract_type(&map_builder_type);
 }
@@ -1,11 +1,48 @@
 #include <immer/map.hpp>
 #include <immer/map_transient.hpp>
 
-#define CAST_MAP(expr) static_cast<immer::map<Janet, Janet> *>((expr))
+typedef immer::map<Janet, Janet, std::hash<Janet>, std::equal_to<Janet>, MemoryPolicy> Map;
+typedef immer::map_transient<Janet, Janet, std::hash<Janet>, std::equal_to<Janet>, MemoryPolicy> TMap;
+
+// The abstract holds the map along with its cached hash. Everything that
+// doesn't care about the hash can treat it as a plain Map.
+struct MapBox : Map {
+  HashCache hash;
+};
+
+// Value-initializing a MapBox zeroes its hash cache.
+#define CAST_MAP_BOX(expr) static_cast<MapBox *>((expr))
+#define CAST_MAP(expr) static_cast<Map *>(CAST_MAP_BOX(expr))
 #define CAST_MAP_ITERATOR(expr) static_cast<MapIterator *>((expr))
-#define NEW_MAP() new (janet_abstract(&map_type, sizeof(immer::map<Janet, Janet>))) immer::map<Janet, Janet>()
+#define NEW_MAP() CAST_MAP((mark_arm(), new (janet_abstract(&map_type, sizeof(MapBox))) MapBox()))
 #define KVP(k, v) std::pair<Janet, Janet>((k), (v))
 
+#define CAST_TMAP(expr) static_cast<TMap *>((expr))
+#define NEW_TMAP() new (janet_abstract(&tmap_type, sizeof(TMap))) TMap()
+
+static int tmap_gc(void *data, size_t len) {
+  (void) len;
+  auto tmap = CAST_TMAP(data);
+  tmap->~map_transient();
+  return 0;
+}
+
+// The tmap abstract type is not exposed to the user. Its only use is to properly deallocate even when there is a panic.
+static const JanetAbstractType tmap_type = {
+  .name = "jimmy/tmap",
+  .gc = tmap_gc,
+  .gcmark = NULL,
+  .get = NULL,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = NULL,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
 typedef enum {
   Keys,
   Values,
@@ -13,7 +50,7 @@ typedef enum {
 } IteratorType;
 
 typedef struct {
-  immer::map<Janet, Janet>::iterator actual;
+  Map::iterator actual;
   Janet backing_map;
   IteratorType type;
 } MapIterator;
@@ -91,18 +128,18 @@ static int map_iterator_get(void *data, Janet key, Janet *out) {
 
 static int map_gc(void *data, size_t len) {
   (void) len;
-  auto map = CAST_MAP(data);
-  map->~map();
+  auto box = CAST_MAP_BOX(data);
+  box->~MapBox();
   return 0;
 }
 
 static int map_gcmark(void *data, size_t len) {
   (void) len;
   auto map = CAST_MAP(data);
-  for (auto pair : *map) {
+  mark_champ(map->impl(), [](const std::pair<Janet, Janet> &pair) {
     janet_mark(pair.first);
     janet_mark(pair.second);
-  }
+  });
   return 0;
 }
 
@@ -134,12 +171,19 @@ static const JanetMethod map_methods[] = {
   {NULL, NULL}
 };
 
+// Keys in the map take precedence over methods, so `(get m :length)` only
+// finds the method if the map has no `:length` key.
 static int map_get(void *data, Janet key, Janet *out) {
   if (janet_checkabstract(key, &map_iterator_type)) {
     auto iterator = CAST_MAP_ITERATOR(janet_unwrap_abstract(key));
     check_map_iterator(data, iterator);
     *out = map_iterator_value(iterator);
     return 1;
+  }
+  const Janet *value = CAST_MAP(data)->find(key);
+  if (value != NULL) {
+    *out = *value;
+    return 1;
   } else if (janet_checktype(key, JANET_KEYWORD)) {
     return janet_getmethod(janet_unwrap_keyword(key), map_methods, out);
   } else {
@@ -147,7 +191,7 @@ static int map_get(void *data, Janet key, Janet *out) {
   }
 }
 
-static Janet new_map_iterator(immer::map<Janet, Janet> *map, IteratorType type) {
+static Janet new_map_iterator(Map *map, IteratorType type) {
   if (map->size() == 0) {
     return janet_wrap_nil();
   }
@@ -195,52 +239,191 @@ static Janet map_call(void *data, int32_t argc, Janet *argv) {
   }
 }
 
+static thread_local MarshalHistory<Map> map_marshal_history;
+static thread_local MarshalHistory<Map> map_unmarshal_history;
+
 static void map_marshal(void *data, JanetMarshalContext *ctx) {
   janet_marshal_abstract(ctx, data);
+  janet_marshal_int(ctx, MARSHAL_FORMAT);
+  marshal_begin(ctx);
   auto map = CAST_MAP(data);
-  janet_marshal_int(ctx, static_cast<int32_t>(map->size()));
-  for (auto pair : *map) {
-    janet_marshal_janet(ctx, pair.first);
-    janet_marshal_janet(ctx, pair.second);
+  auto &history = map_marshal_history.current(marshal_generation);
+
+  auto immediate = [](const std::pair<Janet, Janet> &pair) {
+    return marshal_immediate(pair.first) && marshal_immediate(pair.second);
+  };
+  if (marshal_shareable(ctx) && marshal_every(*map, immediate)) {
+    marshal_share(ctx, *map);
+    history.push_back(map);
+    return;
+  }
+
+  int32_t base = MARSHAL_NO_BASE;
+  std::vector<Janet> removed;
+  std::vector<std::pair<Janet, Janet>> updated;
+  size_t limit = map->size() / 2;
+  for (size_t i = history.size(), tried = 0; i > 0 && tried < MARSHAL_BASE_CANDIDATES; i--) {
+    auto candidate = history[i - 1];
+    auto size_difference = candidate->size() > map->size() ? candidate->size() - map->size() : map->size() - candidate->size();
+    if (size_difference >= limit) {
+      continue;
+    }
+    tried++;
+    removed.clear();
+    updated.clear();
+    bool small = structural_diff_within(limit, *candidate, *map,
+      [&](const std::pair<Janet, Janet> &pair) { updated.push_back(pair); },
+      [&](const std::pair<Janet, Janet> &pair) { removed.push_back(pair.first); },
+      [&](const std::pair<Janet, Janet> &, const std::pair<Janet, Janet> &pair) { updated.push_back(pair); });
+    if (small) {
+      base = static_cast<int32_t>(i - 1);
+      break;
+    }
+  }
+
+  janet_marshal_int(ctx, base);
+  if (base == MARSHAL_NO_BASE) {
+    janet_marshal_int(ctx, static_cast<int32_t>(map->size()));
+    for (auto pair : *map) {
+      janet_marshal_janet(ctx, pair.first);
+      janet_marshal_janet(ctx, pair.second);
+    }
+  } else {
+    janet_marshal_int(ctx, static_cast<int32_t>(removed.size()));
+    for (auto key : removed) {
+      janet_marshal_janet(ctx, key);
+    }
+    janet_marshal_int(ctx, static_cast<int32_t>(updated.size()));
+    for (auto pair : updated) {
+      janet_marshal_janet(ctx, pair.first);
+      janet_marshal_janet(ctx, pair.second);
+    }
   }
+  history.push_back(map);
 }
 
-static void *map_unmarshal(JanetMarshalContext *ctx) {
-  auto map = CAST_MAP(janet_unmarshal_abstract(ctx, sizeof(immer::map<Janet, Janet>)));
-  new (map) immer::map<Janet, Janet>();
+static void map_unmarshal_entries(JanetMarshalContext *ctx, Map *map, int32_t size) {
   auto transient = map->transient();
-  int32_t size = janet_unmarshal_int(ctx);
   for (int32_t i = 0; i < size; i++) {
     auto key = janet_unmarshal_janet(ctx);
     auto value = janet_unmarshal_janet(ctx);
     transient.insert(KVP(key, value));
   }
   *map = transient.persistent();
+}
+
+static void *map_unmarshal(JanetMarshalContext *ctx) {
+  auto map = CAST_MAP(new (janet_unmarshal_abstract(ctx, sizeof(MapBox))) MapBox());
+  int32_t old_size = unmarshal_format(ctx);
+  if (old_size != MARSHAL_FORMAT) {
+    map_unmarshal_entries(ctx, map, old_size);
+    return map;
+  }
+  unmarshal_begin(ctx);
+  auto &history = map_unmarshal_history.current(unmarshal_generation);
+  int32_t base = unmarshal_base(ctx, history.size());
+  if (base == MARSHAL_SHARED) {
+    unmarshal_share(ctx, *map);
+  } else if (base == MARSHAL_NO_BASE) {
+    map_unmarshal_entries(ctx, map, janet_unmarshal_int(ctx));
+  } else {
+    JanetArray *removed = janet_array(0);
+    int32_t removed_count = janet_unmarshal_int(ctx);
+    for (int32_t i = 0; i < removed_count; i++) {
+      janet_array_push(removed, janet_unmarshal_janet(ctx));
+    }
+    JanetArray *updated = janet_array(0);
+    int32_t updated_count = janet_unmarshal_int(ctx);
+    for (int32_t i = 0; i < 2 * updated_count; i++) {
+      janet_array_push(updated, janet_unmarshal_janet(ctx));
+    }
+    auto transient = history[base]->transient();
+    for (int32_t i = 0; i < removed->count; i++) {
+      transient.erase(removed->data[i]);
+    }
+    for (int32_t i = 0; i < updated->count; i += 2) {
+      transient.set(updated->data[i], updated->data[i + 1]);
+    }
+    *map = transient.persistent();
+  }
+  history.push_back(map);
   return map;
 }
 
 static int map_compare(void *data1, void *data2) {
   auto map1 = CAST_MAP(data1);
   auto map2 = CAST_MAP(data2);
-  if (*map1 == *map2) {
+  if (!hashes_differ(CAST_MAP_BOX(map1)->hash, CAST_MAP_BOX(map2)->hash) && *map1 == *map2) {
     return 0;
   }
   return map1 > map2 ? 1 : -1;
 }
 
+static uint32_t map_entry_hash(Janet key, Janet value) {
+  int32_t hash = hash_mix(static_cast<int32_t>(std::hash<Janet>()(key)), static_cast<int32_t>(std::hash<Janet>()(value)));
+  return hash_scramble(hash);
+}
+
 static int32_t map_hash(void *data, size_t len) {
   (void) len;
-  auto map = CAST_MAP(data);
-  // start with a random permutation of 16 1s and 16 0s
-  uint32_t hash = 0b11100110010111010100001111000001;
-  // Iteration is order is stable over hash values, regardless
-  // of how you construct the map.
-  // https://github.com/arximboldi/immer/discussions/249#discussioncomment-4620734
-  for (auto pair : *map) {
-    hash = hash_mix(hash, static_cast<int32_t>(std::hash<Janet>()(pair.first)));
-    hash = hash_mix(hash, static_cast<int32_t>(std::hash<Janet>()(pair.second)));
+  auto box = CAST_MAP_BOX(data);
+  if (!box->hash.valid) {
+    // start with a random permutation of 16 1s and 16 0s
+    uint32_t hash = 0b11100110010111010100001111000001;
+    for (auto pair : *box) {
+      hash += map_entry_hash(pair.first, pair.second);
+    }
+    box->hash.value = hash;
+    box->hash.valid = true;
+  }
+  return static_cast<int32_t>(box->hash.value);
+}
+
+static void map_derive_hash_from(HashCache old_hash, Map *new_map, uint32_t added, uint32_t removed) {
+  if (old_hash.valid) {
+    auto new_box = CAST_MAP_BOX(new_map);
+    new_box->hash.value = old_hash.value + added - removed;
+    new_box->hash.valid = true;
   }
-  return hash;
+}
+
+static void map_derive_hash(Map *old_map, Map *new_map, uint32_t added, uint32_t removed) {
+  map_derive_hash_from(CAST_MAP_BOX(old_map)->hash, new_map, added, removed);
+}
+
+// Tracks how a sequence of puts and removes changes a map's hash, so that we
+// can derive the new map's hash from the old one. Only bothers if the old
+// map's hash is known.
+typedef struct {
+  bool track;
+  uint32_t added;
+  uint32_t removed;
+} MapHashDelta;
+
+static MapHashDelta map_hash_delta(Map *map) {
+  return MapHashDelta { CAST_MAP_BOX(map)->hash.valid, 0, 0 };
+}
+
+static void map_transient_put(TMap &transient, MapHashDelta &delta, Janet key, Janet value) {
+  if (delta.track) {
+    const Janet *old_value = transient.find(key);
+    if (old_value != NULL) {
+      delta.removed += map_entry_hash(key, *old_value);
+    }
+    delta.added += map_entry_hash(key, value);
+  }
+  transient.set(key, value);
+}
+
+static void map_transient_remove(TMap &transient, MapHashDelta &delta, Janet key) {
+  if (delta.track) {
+    const Janet *old_value = transient.find(key);
+    if (old_value == NULL) {
+      return;
+    }
+    delta.removed += map_entry_hash(key, *old_value);
+  }
+  transient.erase(key);
 }
 
 static const JanetAbstractType map_type = {
@@ -258,15 +441,26 @@ static const JanetAbstractType map_type = {
   .call = map_call,
 };
 
+// `kvs` holds `count` keys, each followed by its value.
+static void map_set_all(TMap &transient, const Janet *kvs, int32_t count) {
+  if (static_cast<size_t>(count) < BULK_LOAD_MIN) {
+    for (int32_t i = 0; i < count; i++) {
+      transient.set(kvs[2 * i], kvs[2 * i + 1]);
+    }
+    return;
+  }
+  for (auto offset : bulk_load_order(kvs, count, 2)) {
+    transient.set(kvs[offset], kvs[offset + 1]);
+  }
+}
+
 static Janet cfun_map_new(int32_t argc, Janet *argv) {
   if (argc % 2 == 1) {
     janet_panic("expected even number of arguments");
   }
   auto map = NEW_MAP();
   auto transient = map->transient();
-  for (int32_t i = 0; i < argc; i += 2) {
-    transient.insert(KVP(argv[i + 0], argv[i + 1]));
-  }
+  map_set_all(transient, argv, argc / 2);
   *map = transient.persistent();
   return janet_wrap_abstract(map);
 }
@@ -286,6 +480,233 @@ static Janet cfun_map_pairs(int32_t argc, Janet *argv) {
   return new_map_iterator(CAST_MAP(janet_getabstract(argv, 0, &map_type)), IteratorType::Pairs);
 }
 
+static Janet cfun_map_of(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  if (janet_checkabstract(argv[0], &map_type)) {
+    return argv[0];
+  }
+  const JanetKV *kvs;
+  int32_t length, capacity;
+  if (!janet_dictionary_view(argv[0], &kvs, &length, &capacity)) {
+    janet_panicf("expected table or struct, got %v", argv[0]);
+  }
+  auto map = NEW_MAP();
+  auto transient = map->transient();
+  std::vector<Janet> flat;
+  flat.reserve(2 * length);
+  for (int32_t i = 0; i < capacity; i++) {
+    if (!janet_checktype(kvs[i].key, JANET_NIL)) {
+      flat.push_back(kvs[i].key);
+      flat.push_back(kvs[i].value);
+    }
+  }
+  map_set_all(transient, flat.data(), static_cast<int32_t>(flat.size() / 2));
+  *map = transient.persistent();
+  return janet_wrap_abstract(map);
+}
+
+static Janet cfun_map_to_table(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  JanetTable *table = janet_table(static_cast<int32_t>(map->size()));
+  for (auto pair : *map) {
+    janet_table_put(table, pair.first, pair.second);
+  }
+  return janet_wrap_table(table);
+}
+
+static Janet cfun_map_to_struct(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  JanetKV *st = janet_struct_begin(static_cast<int32_t>(map->size()));
+  for (auto pair : *map) {
+    janet_struct_put(st, pair.first, pair.second);
+  }
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+static Janet cfun_map_get(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+  auto map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  const Janet *value = map->find(argv[1]);
+  if (value != NULL) {
+    return *value;
+  }
+  return argc == 3 ? argv[2] : janet_wrap_nil();
+}
+
+static Janet cfun_map_has_key(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  return janet_wrap_boolean(map->count(argv[1]) != 0);
+}
+
+static Janet cfun_map_put(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto old_map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  if (argc % 2 == 0) {
+    janet_panic("expected even number of arguments");
+  }
+  auto new_map = NEW_MAP();
+
+  auto delta = map_hash_delta(old_map);
+  auto transient = old_map->transient();
+  for (int32_t i = 1; i < argc; i += 2) {
+    map_transient_put(transient, delta, argv[i], argv[i + 1]);
+  }
+  *new_map = transient.persistent();
+  map_derive_hash(old_map, new_map, delta.added, delta.removed);
+  return janet_wrap_abstract(new_map);
+}
+
+static Janet cfun_map_remove(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto old_map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  auto new_map = NEW_MAP();
+
+  auto delta = map_hash_delta(old_map);
+  auto transient = old_map->transient();
+  for (int32_t i = 1; i < argc; i++) {
+    map_transient_remove(transient, delta, argv[i]);
+  }
+  *new_map = transient.persistent();
+  map_derive_hash(old_map, new_map, delta.added, delta.removed);
+  return janet_wrap_abstract(new_map);
+}
+
+static Janet cfun_map_update(int32_t argc, Janet *argv) {
+  janet_arity(argc, 3, -1);
+  auto old_map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  Janet key = argv[1];
+  Janet f = argv[2];
+
+  const Janet *old_value = old_map->find(key);
+  Janet new_value = call_with_first(f, old_value == NULL ? janet_wrap_nil() : *old_value, argv + 3, argc - 3);
+
+  auto new_map = NEW_MAP();
+  *new_map = old_map->set(key, new_value);
+  uint32_t removed = old_value == NULL ? 0 : map_entry_hash(key, *old_value);
+  map_derive_hash(old_map, new_map, map_entry_hash(key, new_value), removed);
+  return janet_wrap_abstract(new_map);
+}
+
+// Merges into an accumulated map, one argument at a time. When the next map
+// has a similar size, it's probably a version of the accumulated map, so we
+// only need to visit the entries that differ between them. `maps` can't be
+// empty.
+static Map map_merge_of(const std::vector<Map *> &maps, MapHashDelta &delta) {
+  Map accumulated = *maps[0];
+  for (size_t i = 1; i < maps.size(); i++) {
+    auto map = maps[i];
+    auto transient = accumulated.transient();
+    if (similar_size(accumulated, *map)) {
+      structural_diff(accumulated, *map, [&](const std::pair<Janet, Janet> &pair) {
+        map_transient_put(transient, delta, pair.first, pair.second);
+      }, [](const std::pair<Janet, Janet> &) {
+      }, [&](const std::pair<Janet, Janet> &, const std::pair<Janet, Janet> &after) {
+        map_transient_put(transient, delta, after.first, after.second);
+      });
+    } else {
+      for (auto pair : *map) {
+        map_transient_put(transient, delta, pair.first, pair.second);
+      }
+    }
+    accumulated = transient.persistent();
+  }
+  return accumulated;
+}
+
+// Checks the type of every argument before it allocates anything.
+static std::vector<Map *> maps_of_args(int32_t argc, Janet *argv) {
+  for (int32_t i = 0; i < argc; i++) {
+    janet_getabstract(argv, i, &map_type);
+  }
+  std::vector<Map *> maps;
+  maps.reserve(argc);
+  for (int32_t i = 0; i < argc; i++) {
+    maps.push_back(CAST_MAP(janet_unwrap_abstract(argv[i])));
+  }
+  return maps;
+}
+
+static Janet cfun_map_merge(int32_t argc, Janet *argv) {
+  auto maps = maps_of_args(argc, argv);
+  if (argc == 0) {
+    return janet_wrap_abstract(NEW_MAP());
+  }
+  auto new_map = NEW_MAP();
+  auto delta = map_hash_delta(maps[0]);
+  *new_map = map_merge_of(maps, delta);
+  map_derive_hash(maps[0], new_map, delta.added, delta.removed);
+  return janet_wrap_abstract(new_map);
+}
+
+static Janet cfun_map_merge_with(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  Janet f = argv[0];
+  for (int32_t i = 1; i < argc; i++) {
+    janet_getabstract(argv, i, &map_type);
+  }
+  if (argc == 1) {
+    return janet_wrap_abstract(NEW_MAP());
+  }
+  auto first_map = CAST_MAP(janet_unwrap_abstract(argv[1]));
+  auto new_map = NEW_MAP();
+
+  auto delta = map_hash_delta(first_map);
+  auto transient = NEW_TMAP();
+  *transient = first_map->transient();
+  for (int32_t i = 2; i < argc; i++) {
+    auto map = CAST_MAP(janet_unwrap_abstract(argv[i]));
+    for (auto pair : *map) {
+      const Janet *old_value = transient->find(pair.first);
+      if (old_value == NULL) {
+        map_transient_put(*transient, delta, pair.first, pair.second);
+      } else {
+        Janet args[2] = { *old_value, pair.second };
+        map_transient_put(*transient, delta, pair.first, call_callable(f, 2, args));
+      }
+    }
+  }
+  *new_map = transient->persistent();
+  map_derive_hash(first_map, new_map, delta.added, delta.removed);
+  return janet_wrap_abstract(new_map);
+}
+
+// Costs time proportional to the number of entries that differ, as long as
+// the two maps are versions of each other.
+static Janet cfun_map_diff(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto old_map = CAST_MAP(janet_getabstract(argv, 0, &map_type));
+  auto new_map = CAST_MAP(janet_getabstract(argv, 1, &map_type));
+  auto added = NEW_MAP();
+  auto removed = NEW_MAP();
+  auto changed = NEW_MAP();
+  auto added_transient = added->transient();
+  auto removed_transient = removed->transient();
+  auto changed_transient = changed->transient();
+  structural_diff(*old_map, *new_map, [&](const std::pair<Janet, Janet> &pair) {
+    added_transient.insert(pair);
+  }, [&](const std::pair<Janet, Janet> &pair) {
+    removed_transient.insert(pair);
+  }, [&](const std::pair<Janet, Janet> &before, const std::pair<Janet, Janet> &after) {
+    // immer reports every entry that it can't prove unchanged by pointer, so
+    // we still need to compare the values.
+    if (!janet_equals(before.second, after.second)) {
+      changed_transient.insert(KVP(after.first, pair_to_tuple(KVP(before.second, after.second))));
+    }
+  });
+  *added = added_transient.persistent();
+  *removed = removed_transient.persistent();
+  *changed = changed_transient.persistent();
+
+  JanetKV *result = janet_struct_begin(3);
+  janet_struct_put(result, janet_ckeywordv("added"), janet_wrap_abstract(added));
+  janet_struct_put(result, janet_ckeywordv("removed"), janet_wrap_abstract(removed));
+  janet_struct_put(result, janet_ckeywordv("changed"), janet_wrap_abstract(changed));
+  return janet_wrap_struct(janet_struct_end(result));
+}
+
 static const JanetReg map_cfuns[] = {
   {"map/new", cfun_map_new, "(map/new & kvs)\n\n"
     "Returns a persistent immutable map containing the listed entries."},
@@ -295,5 +716,35 @@ static const JanetReg map_cfuns[] = {
     "Returns an iterator over the values in the map."},
   {"map/pairs", cfun_map_pairs, "(map/pairs map)\n\n"
     "Returns an iterator over the key-value pairs in the map."},
+  {"map/of", cfun_map_of, "(map/of dict)\n\n"
+    "Returns a map containing all of the entries in a table or struct."},
+  {"map/to-table", cfun_map_to_table, "(map/to-table map)\n\n"
+    "Returns a new table with all of the entries in the map."},
+  {"map/to-struct", cfun_map_to_struct, "(map/to-struct map)\n\n"
+    "Returns a struct with all of the entries in the map."},
+  {"map/get", cfun_map_get, "(map/get map key &opt default)\n\n"
+    "Returns the value associated with `key`, or `default` if the map does not contain it. "
+    "Unlike `get`, this never falls back to the map's methods."},
+  {"map/has-key?", cfun_map_has_key, "(map/has-key? map key)\n\n"
+    "Returns true if the map contains the given key, even if its value is `nil`."},
+  {"map/put", cfun_map_put, "(map/put map & kvs)\n\n"
+    "Returns a new map containing all of the entries from the original map and all of the subsequent key-value pairs."},
+  {"map/remove", cfun_map_remove, "(map/remove map & keys)\n\n"
+    "Returns a new map containing all of the entries from the original map except the ones with any of the subsequent keys."},
+  {"map/update", cfun_map_update, "(map/update map key f & args)\n\n"
+    "Returns a new map where the value for `key` is `(f old-value ;args)`. "
+    "`old-value` is `nil` if the map did not contain the key. "
+    "`f` can be any callable value, not just a function."},
+  {"map/merge", cfun_map_merge, "(map/merge & maps)\n\n"
+    "Returns a map containing all of the entries of all of its arguments. "
+    "If a key appears in more than one map, the value from the last map wins."},
+  {"map/merge-with", cfun_map_merge_with, "(map/merge-with f & maps)\n\n"
+    "Like `map/merge`, but if a key appears in more than one map, its value will be `(f old-value new-value)`. "
+    "`f` can be any callable value, not just a function."},
+  {"map/diff", cfun_map_diff, "(map/diff old new)\n\n"
+    "Returns a struct with three maps: `:added`, the entries whose keys are only in `new`; `:removed`, "
+    "the entries whose keys are only in `old`; and `:changed`, which maps every key whose value changed to "
+    "a tuple of `[old-value new-value]`. Subtrees that the two maps share are skipped, so diffing two "
+    "versions of the same map is proportional to the number of changes, not the size of the maps."},
   {NULL, NULL, NULL}
 };
@@ -0,0 +1,784 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only sets and maps backed by a memory-mapped file.
+//
+// The file is an open-addressing hash table: a header, an array of slots,
+// and the entries themselves. Each slot holds the offset of an entry, plus
+// one, so that zero marks an empty slot. Lookups hash the encoded key and
+// probe the slots linearly, so opening a file doesn't read anything but its
+// header, and a lookup only touches the pages it needs. Processes that map
+// the same file share its pages.
+//
+// Keys and values are nil, booleans, numbers, strings, keywords and symbols,
+// each encoded as a tag byte followed by its contents. Keys are compared by
+// their encodings, which is why numbers are normalized before they're
+// encoded.
+//
+// Edits go to an in-memory layer over the file: a sorted map of added
+// entries, which shadow the file, and a sorted set of keys removed from the
+// file. Both are the treaps from sorted.cpp, so we can iterate past any key
+// without a separate iterator type.
+
+static const char MAPPED_MAGIC[8] = {'j', 'i', 'm', 'm', 'y', 'm', 'a', 'p'};
+static const uint32_t MAPPED_VERSION = 1;
+static const uint32_t MAPPED_BYTE_ORDER = 0x01020304;
+
+// magic, version, byte order, flags, reserved, count, slot count, data size
+static const size_t MAPPED_HEADER_SIZE = 8 + 4 + 4 + 4 + 4 + 8 + 8 + 8;
+static const uint32_t MAPPED_FLAG_MAP = 1;
+
+enum {
+  MAPPED_NIL,
+  MAPPED_FALSE,
+  MAPPED_TRUE,
+  MAPPED_NUMBER,
+  MAPPED_STRING,
+  MAPPED_KEYWORD,
+  MAPPED_SYMBOL,
+};
+
+typedef struct MappedFile : MemoryPolicy::refcount {
+  const uint8_t *bytes;
+  size_t size;
+  bool is_map;
+  uint64_t count;
+  uint64_t slot_count;
+  const uint8_t *slots;
+  const uint8_t *data;
+  uint64_t data_size;
+} MappedFile;
+
+typedef struct {
+  MappedFile *file;
+  SortedNode *added;
+  SortedNode *removed;
+  // The number of added keys that are also in the file.
+  size_t shadowed;
+} MappedBox;
+
+#define CAST_MAPPED(expr) static_cast<MappedBox *>((expr))
+
+// Encoding
+
+static uint32_t mapped_read_u32(const uint8_t *p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static uint64_t mapped_read_u64(const uint8_t *p) {
+  uint64_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+template <typename T>
+static void mapped_push(std::vector<uint8_t> &out, T x) {
+  auto p = reinterpret_cast<const uint8_t *>(&x);
+  out.insert(out.end(), p, p + sizeof(x));
+}
+
+static void mapped_push_bytes(std::vector<uint8_t> &out, uint8_t tag, const uint8_t *bytes, int32_t length) {
+  out.push_back(tag);
+  mapped_push(out, static_cast<uint32_t>(length));
+  out.insert(out.end(), bytes, bytes + length);
+}
+
+// Returns false if `x` can't be stored in a mapped file.
+static bool mapped_encode(std::vector<uint8_t> &out, Janet x) {
+  switch (janet_type(x)) {
+  case JANET_NIL:
+    out.push_back(MAPPED_NIL);
+    return true;
+  case JANET_BOOLEAN:
+    out.push_back(janet_unwrap_boolean(x) ? MAPPED_TRUE : MAPPED_FALSE);
+    return true;
+  case JANET_NUMBER: {
+    double number = janet_unwrap_number(x);
+    // -0 and 0 are equal, so they need the same encoding.
+    if (number == 0) {
+      number = 0;
+    }
+    out.push_back(MAPPED_NUMBER);
+    mapped_push(out, number);
+    return true;
+  }
+  case JANET_STRING: {
+    auto s = janet_unwrap_string(x);
+    mapped_push_bytes(out, MAPPED_STRING, s, janet_string_length(s));
+    return true;
+  }
+  case JANET_KEYWORD: {
+    auto s = janet_unwrap_keyword(x);
+    mapped_push_bytes(out, MAPPED_KEYWORD, s, janet_string_length(s));
+    return true;
+  }
+  case JANET_SYMBOL: {
+    auto s = janet_unwrap_symbol(x);
+    mapped_push_bytes(out, MAPPED_SYMBOL, s, janet_string_length(s));
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+[[noreturn]] static void mapped_corrupt() {
+  janet_panic("corrupt mapped file");
+}
+
+// Returns the offset just past the value that starts at `offset`, or 0 if
+// the file is corrupt. This doesn't panic, for callers that have to free
+// something first.
+static uint64_t mapped_end(const MappedFile *file, uint64_t offset) {
+  if (offset >= file->data_size) {
+    return 0;
+  }
+  uint64_t end;
+  switch (file->data[offset]) {
+  case MAPPED_NIL:
+  case MAPPED_FALSE:
+  case MAPPED_TRUE:
+    end = offset + 1;
+    break;
+  case MAPPED_NUMBER:
+    end = offset + 1 + sizeof(double);
+    break;
+  case MAPPED_STRING:
+  case MAPPED_KEYWORD:
+  case MAPPED_SYMBOL:
+    if (file->data_size - offset < 1 + sizeof(uint32_t)) {
+      return 0;
+    }
+    end = offset + 1 + sizeof(uint32_t) + mapped_read_u32(file->data + offset + 1);
+    break;
+  default:
+    return 0;
+  }
+  return end > file->data_size ? 0 : end;
+}
+
+static uint64_t mapped_skip(const MappedFile *file, uint64_t offset) {
+  uint64_t end = mapped_end(file, offset);
+  if (end == 0) {
+    mapped_corrupt();
+  }
+  return end;
+}
+
+static Janet mapped_decode(const MappedFile *file, uint64_t offset) {
+  mapped_skip(file, offset);
+  const uint8_t *p = file->data + offset;
+  const uint8_t *contents = p + 1 + sizeof(uint32_t);
+  switch (p[0]) {
+  case MAPPED_NIL:
+    return janet_wrap_nil();
+  case MAPPED_FALSE:
+    return janet_wrap_false();
+  case MAPPED_TRUE:
+    return janet_wrap_true();
+  case MAPPED_NUMBER: {
+    double number;
+    memcpy(&number, p + 1, sizeof(number));
+    return janet_wrap_number(number);
+  }
+  case MAPPED_STRING:
+    return janet_stringv(contents, mapped_read_u32(p + 1));
+  case MAPPED_KEYWORD:
+    return janet_keywordv(contents, mapped_read_u32(p + 1));
+  default:
+    return janet_symbolv(contents, mapped_read_u32(p + 1));
+  }
+}
+
+static uint64_t mapped_hash(const uint8_t *bytes, size_t length) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// The file
+
+static uint64_t mapped_slot(const MappedFile *file, uint64_t slot) {
+  return mapped_read_u64(file->slots + slot * sizeof(uint64_t));
+}
+
+// Finds the slot holding `key`. Returns false if `key` isn't in the file.
+static bool mapped_find(const MappedFile *file, Janet key, uint64_t *slot_out) {
+  // Panicking would skip the destructor of `encoded`, so we only panic once
+  // it's gone.
+  bool found = false;
+  bool corrupt = false;
+  {
+    std::vector<uint8_t> encoded;
+    if (!mapped_encode(encoded, key)) {
+      return false;
+    }
+    uint64_t mask = file->slot_count - 1;
+    uint64_t slot = mapped_hash(encoded.data(), encoded.size()) & mask;
+    for (uint64_t probes = 0; probes < file->slot_count; probes++) {
+      uint64_t entry = mapped_slot(file, slot);
+      if (entry == 0) {
+        break;
+      }
+      uint64_t offset = entry - 1;
+      uint64_t end = mapped_end(file, offset);
+      if (end == 0) {
+        corrupt = true;
+        break;
+      }
+      if (end - offset == encoded.size() && memcmp(file->data + offset, encoded.data(), encoded.size()) == 0) {
+        *slot_out = slot;
+        found = true;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
+  if (corrupt) {
+    mapped_corrupt();
+  }
+  return found;
+}
+
+static Janet mapped_key_at(const MappedFile *file, uint64_t slot) {
+  return mapped_decode(file, mapped_slot(file, slot) - 1);
+}
+
+static Janet mapped_value_at(const MappedFile *file, uint64_t slot) {
+  uint64_t offset = mapped_slot(file, slot) - 1;
+  return file->is_map ? mapped_decode(file, mapped_skip(file, offset)) : mapped_decode(file, offset);
+}
+
+static void mapped_release(MappedFile *file) {
+  if (file->dec()) {
+#ifndef _WIN32
+    munmap(const_cast<uint8_t *>(file->bytes), file->size);
+#endif
+    file->~MappedFile();
+    JanetHeap::deallocate(sizeof(MappedFile), file);
+  }
+}
+
+// The layered collection
+
+static bool mapped_in_base(const MappedBox *box, Janet key, uint64_t *slot) {
+  return mapped_find(box->file, key, slot) && sorted_find(box->removed, key) == NULL;
+}
+
+static bool mapped_live_slot(const MappedBox *box, uint64_t slot, Janet *key) {
+  if (mapped_slot(box->file, slot) == 0) {
+    return false;
+  }
+  *key = mapped_key_at(box->file, slot);
+  return sorted_find(box->added, *key) == NULL && sorted_find(box->removed, *key) == NULL;
+}
+
+static size_t mapped_size(const MappedBox *box) {
+  return box->file->count - sorted_size(box->removed) - box->shadowed + sorted_size(box->added);
+}
+
+// Looks up `key`, and returns false if it isn't there.
+static bool mapped_lookup(const MappedBox *box, Janet key, Janet *out) {
+  const SortedNode *node = janet_checktype(key, JANET_NIL) ? NULL : sorted_find(box->added, key);
+  if (node != NULL) {
+    *out = node->value;
+    return true;
+  }
+  uint64_t slot;
+  if (!janet_checktype(key, JANET_NIL) && mapped_in_base(box, key, &slot)) {
+    *out = mapped_value_at(box->file, slot);
+    return true;
+  }
+  return false;
+}
+
+// Visits every live entry: first the ones in the file, in slot order, and
+// then the added ones, in key order.
+template <typename Fn>
+static void mapped_for_each(const MappedBox *box, Fn &&fn) {
+  for (uint64_t slot = 0; slot < box->file->slot_count; slot++) {
+    Janet key;
+    if (mapped_live_slot(box, slot, &key)) {
+      fn(key, mapped_value_at(box->file, slot));
+    }
+  }
+  sorted_for_each(box->added, [&](const SortedNode *node) {
+    fn(node->key, node->value);
+  });
+}
+
+// The abstract types
+
+static int mapped_gc(void *data, size_t len) {
+  (void) len;
+  auto box = CAST_MAPPED(data);
+  sorted_release(box->added);
+  sorted_release(box->removed);
+  mapped_release(box->file);
+  return 0;
+}
+
+static int mapped_gcmark(void *data, size_t len) {
+  (void) len;
+  sorted_mark_node(CAST_MAPPED(data)->added);
+  sorted_mark_node(CAST_MAPPED(data)->removed);
+  return 0;
+}
+
+static Janet cfun_mapped_length(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return janet_wrap_number(static_cast<double>(mapped_size(CAST_MAPPED(janet_unwrap_abstract(argv[0])))));
+}
+
+static const JanetMethod mapped_methods[] = {
+  {"length", cfun_mapped_length},
+  {NULL, NULL}
+};
+
+// Like sorted collections, mapped collections use their keys as iteration
+// keys.
+static int mapped_get(void *data, Janet key, Janet *out) {
+  if (mapped_lookup(CAST_MAPPED(data), key, out)) {
+    return 1;
+  } else if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), mapped_methods, out);
+  } else {
+    return 0;
+  }
+}
+
+static Janet mapped_next(void *data, Janet key) {
+  auto box = CAST_MAPPED(data);
+  uint64_t slot = 0;
+  if (!janet_checktype(key, JANET_NIL)) {
+    if (sorted_find(box->added, key) != NULL) {
+      const SortedNode *node = sorted_ceiling(box->added, key, false);
+      return node == NULL ? janet_wrap_nil() : node->key;
+    }
+    if (!mapped_in_base(box, key, &slot)) {
+      janet_panicf("illegal key %v", key);
+    }
+    slot++;
+  }
+  for (; slot < box->file->slot_count; slot++) {
+    Janet next;
+    if (mapped_live_slot(box, slot, &next)) {
+      return next;
+    }
+  }
+  const SortedNode *first = sorted_select(box->added, 0);
+  return first == NULL ? janet_wrap_nil() : first->key;
+}
+
+static Janet mapped_call(void *data, int32_t argc, Janet *argv) {
+  auto box = CAST_MAPPED(data);
+  Janet value;
+  if (!box->file->is_map) {
+    janet_fixarity(argc, 1);
+    return janet_wrap_boolean(mapped_lookup(box, argv[0], &value));
+  }
+  janet_arity(argc, 1, 2);
+  if (mapped_lookup(box, argv[0], &value)) {
+    return value;
+  } else if (argc == 2) {
+    return argv[1];
+  } else {
+    janet_panicf("key %v not found", argv[0]);
+  }
+}
+
+// Printing every entry of a file that was big enough to map would be
+// unhelpful, so these print like builders.
+static void mapped_tostring(void *data, JanetBuffer *buffer) {
+  janet_buffer_push_cstring(buffer, "size ");
+  janet_pretty(buffer, 0, 0, janet_wrap_number(static_cast<double>(mapped_size(CAST_MAPPED(data)))));
+}
+
+static const JanetAbstractType mapped_set_type = {
+  .name = "jimmy/mapped-set",
+  .gc = mapped_gc,
+  .gcmark = mapped_gcmark,
+  .get = mapped_get,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = mapped_tostring,
+  .compare = NULL,
+  .hash = NULL,
+  .next = mapped_next,
+  .call = mapped_call,
+};
+
+static const JanetAbstractType mapped_map_type = {
+  .name = "jimmy/mapped-map",
+  .gc = mapped_gc,
+  .gcmark = mapped_gcmark,
+  .get = mapped_get,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = mapped_tostring,
+  .compare = NULL,
+  .hash = NULL,
+  .next = mapped_next,
+  .call = mapped_call,
+};
+
+// Functions
+
+// Takes ownership of `added` and `removed`, and retains `file`.
+static Janet mapped_wrap(MappedFile *file, SortedNode *added, SortedNode *removed, size_t shadowed) {
+  mark_arm();
+  auto box = CAST_MAPPED(janet_abstract(file->is_map ? &mapped_map_type : &mapped_set_type, sizeof(MappedBox)));
+  file->inc();
+  box->file = file;
+  box->added = added;
+  box->removed = removed;
+  box->shadowed = shadowed;
+  return janet_wrap_abstract(box);
+}
+
+static MappedBox *mapped_getbox(const Janet *argv, int32_t n) {
+  Janet x = argv[n];
+  if (!janet_checkabstract(x, &mapped_set_type) && !janet_checkabstract(x, &mapped_map_type)) {
+    janet_panicf("bad slot #%d, expected jimmy/mapped-set or jimmy/mapped-map, got %v", n, x);
+  }
+  return CAST_MAPPED(janet_unwrap_abstract(x));
+}
+
+static void mapped_check_key(Janet key) {
+  if (janet_checktype(key, JANET_NIL)) {
+    janet_panic("mapped collections cannot contain nil");
+  }
+}
+
+static void mapped_check_encodable(Janet x) {
+  if (!janet_checktypes(x, JANET_TFLAG_NIL | JANET_TFLAG_BOOLEAN | JANET_TFLAG_NUMBER | JANET_TFLAG_STRING
+      | JANET_TFLAG_KEYWORD | JANET_TFLAG_SYMBOL)) {
+    janet_panicf("cannot write %v to a mapped file; expected nil, boolean, number, string, keyword or symbol", x);
+  }
+}
+
+// Writes `kvs`, which holds keys followed by their values if `is_map`, and
+// returns 0 or an errno value. Processes might have the old file mapped, so
+// this writes a new file and moves it into place rather than truncating the
+// old one under them.
+static int mapped_write_file(const char *path, const std::vector<Janet> &kvs, bool is_map) {
+  size_t stride = is_map ? 2 : 1;
+  uint64_t count = kvs.size() / stride;
+  uint64_t slot_count = 8;
+  while (slot_count < count * 2) {
+    slot_count *= 2;
+  }
+  std::vector<uint64_t> slots(slot_count, 0);
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < kvs.size(); i += stride) {
+    uint64_t offset = data.size();
+    mapped_encode(data, kvs[i]);
+    uint64_t slot = mapped_hash(data.data() + offset, data.size() - offset) & (slot_count - 1);
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    slots[slot] = offset + 1;
+    if (is_map) {
+      mapped_encode(data, kvs[i + 1]);
+    }
+  }
+
+  std::vector<uint8_t> header(MAPPED_MAGIC, MAPPED_MAGIC + sizeof(MAPPED_MAGIC));
+  mapped_push(header, MAPPED_VERSION);
+  mapped_push(header, MAPPED_BYTE_ORDER);
+  mapped_push(header, is_map ? MAPPED_FLAG_MAP : static_cast<uint32_t>(0));
+  mapped_push(header, static_cast<uint32_t>(0));
+  mapped_push(header, count);
+  mapped_push(header, slot_count);
+  mapped_push(header, static_cast<uint64_t>(data.size()));
+
+  std::string temp_path = std::string(path) + ".tmp";
+  FILE *out = fopen(temp_path.c_str(), "wb");
+  if (out == NULL) {
+    return errno;
+  }
+  bool ok = fwrite(header.data(), 1, header.size(), out) == header.size()
+    && fwrite(slots.data(), sizeof(uint64_t), slots.size(), out) == slots.size()
+    && fwrite(data.data(), 1, data.size(), out) == data.size();
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), path) != 0) {
+    int error = errno;
+    remove(temp_path.c_str());
+    return error;
+  }
+  return 0;
+}
+
+static Janet cfun_mapped_write(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  const char *path = janet_getcstring(argv, 0);
+  Janet coll = argv[1];
+  bool is_map = janet_checkabstract(coll, &map_type);
+  if (is_map) {
+    for (auto pair : *CAST_MAP(janet_unwrap_abstract(coll))) {
+      mapped_check_key(pair.first);
+      mapped_check_encodable(pair.first);
+      mapped_check_encodable(pair.second);
+    }
+  } else if (janet_checkabstract(coll, &set_type)) {
+    for (auto el : *CAST_SET(janet_unwrap_abstract(coll))) {
+      mapped_check_key(el);
+      mapped_check_encodable(el);
+    }
+  } else {
+    janet_panicf("bad slot #1, expected jimmy/map or jimmy/set, got %v", coll);
+  }
+
+  // Entries are laid out in the order that we visit them, which is also the
+  // order that they'll be iterated in, give or take collisions.
+  int error;
+  {
+    std::vector<Janet> kvs;
+    if (is_map) {
+      for (auto pair : *CAST_MAP(janet_unwrap_abstract(coll))) {
+        kvs.push_back(pair.first);
+        kvs.push_back(pair.second);
+      }
+    } else {
+      for (auto el : *CAST_SET(janet_unwrap_abstract(coll))) {
+        kvs.push_back(el);
+      }
+    }
+    error = mapped_write_file(path, kvs, is_map);
+  }
+  if (error != 0) {
+    janet_panicf("could not write %s: %s", path, strerror(error));
+  }
+  return janet_wrap_nil();
+}
+
+static Janet cfun_mapped_open(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  const char *path = janet_getcstring(argv, 0);
+#ifdef _WIN32
+  janet_panicf("could not open %s: mapped files are not supported on this platform", path);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    janet_panicf("could not open %s: %s", path, strerror(errno));
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    int error = errno;
+    close(fd);
+    janet_panicf("could not open %s: %s", path, strerror(error));
+  }
+  size_t size = static_cast<size_t>(info.st_size);
+  if (size < MAPPED_HEADER_SIZE) {
+    close(fd);
+    janet_panicf("could not open %s: not a mapped file", path);
+  }
+  void *bytes = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  int error = errno;
+  close(fd);
+  if (bytes == MAP_FAILED) {
+    janet_panicf("could not open %s: %s", path, strerror(error));
+  }
+
+  auto p = static_cast<const uint8_t *>(bytes);
+  const char *problem = NULL;
+  uint64_t count = mapped_read_u64(p + 24);
+  uint64_t slot_count = mapped_read_u64(p + 32);
+  uint64_t data_size = mapped_read_u64(p + 40);
+  if (memcmp(p, MAPPED_MAGIC, sizeof(MAPPED_MAGIC)) != 0) {
+    problem = "not a mapped file";
+  } else if (mapped_read_u32(p + 8) != MAPPED_VERSION) {
+    problem = "unsupported version";
+  } else if (mapped_read_u32(p + 12) != MAPPED_BYTE_ORDER) {
+    problem = "written with a different byte order";
+  } else if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || count >= slot_count
+      || slot_count > (size - MAPPED_HEADER_SIZE) / sizeof(uint64_t)
+      || data_size != size - MAPPED_HEADER_SIZE - slot_count * sizeof(uint64_t)) {
+    problem = "corrupt mapped file";
+  }
+  if (problem != NULL) {
+    munmap(bytes, size);
+    janet_panicf("could not open %s: %s", path, problem);
+  }
+
+  auto file = new (JanetHeap::allocate(sizeof(MappedFile))) MappedFile();
+  file->bytes = p;
+  file->size = size;
+  file->is_map = (mapped_read_u32(p + 16) & MAPPED_FLAG_MAP) != 0;
+  file->count = count;
+  file->slot_count = slot_count;
+  file->slots = p + MAPPED_HEADER_SIZE;
+  file->data = file->slots + slot_count * sizeof(uint64_t);
+  file->data_size = data_size;
+  Janet result = mapped_wrap(file, NULL, NULL, 0);
+  // The new box holds the only reference.
+  mapped_release(file);
+  return result;
+#endif
+}
+
+// Returns a new collection with every pair of `kvs` added or replaced.
+static Janet mapped_put_all(MappedBox *box, const Janet *kvs, int32_t count, int32_t stride) {
+  for (int32_t i = 0; i < count; i += stride) {
+    mapped_check_key(kvs[i]);
+  }
+  SortedNode *added = sorted_retain(box->added);
+  SortedNode *removed = sorted_retain(box->removed);
+  size_t shadowed = box->shadowed;
+  Janet result;
+  // A corrupt file panics partway through, so we release whatever we've
+  // built unless mapped_wrap took it.
+  with_cleanup([&]() {
+    for (int32_t i = 0; i < count; i += stride) {
+      Janet key = kvs[i];
+      uint64_t slot;
+      if (sorted_find(removed, key) != NULL) {
+        SortedNode *next = sorted_remove(removed, key);
+        sorted_release(removed);
+        removed = next;
+        shadowed++;
+      } else if (sorted_find(added, key) == NULL && mapped_find(box->file, key, &slot)) {
+        shadowed++;
+      }
+      SortedNode *next = sorted_insert(added, key, kvs[i + stride - 1], sorted_priority(key));
+      sorted_release(added);
+      added = next;
+    }
+    result = mapped_wrap(box->file, added, removed, shadowed);
+    added = NULL;
+    removed = NULL;
+  }, [&]() {
+    sorted_release(added);
+    sorted_release(removed);
+  });
+  return result;
+}
+
+static Janet cfun_mapped_add(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto box = CAST_MAPPED(janet_getabstract(argv, 0, &mapped_set_type));
+  return mapped_put_all(box, argv + 1, argc - 1, 1);
+}
+
+static Janet cfun_mapped_put(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto box = CAST_MAPPED(janet_getabstract(argv, 0, &mapped_map_type));
+  if ((argc - 1) % 2 != 0) {
+    janet_panic("expected even number of key-value arguments");
+  }
+  return mapped_put_all(box, argv + 1, argc - 1, 2);
+}
+
+static Janet cfun_mapped_remove(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto box = mapped_getbox(argv, 0);
+  SortedNode *added = sorted_retain(box->added);
+  SortedNode *removed = sorted_retain(box->removed);
+  size_t shadowed = box->shadowed;
+  Janet result;
+  // Like mapped_put_all.
+  with_cleanup([&]() {
+    for (int32_t i = 1; i < argc; i++) {
+      Janet key = argv[i];
+      if (janet_checktype(key, JANET_NIL)) {
+        continue;
+      }
+      uint64_t slot;
+      bool in_file = mapped_find(box->file, key, &slot);
+      if (sorted_find(added, key) != NULL) {
+        SortedNode *next = sorted_remove(added, key);
+        sorted_release(added);
+        added = next;
+        if (in_file) {
+          shadowed--;
+        }
+      }
+      if (in_file && sorted_find(removed, key) == NULL) {
+        SortedNode *next = sorted_insert(removed, key, key, sorted_priority(key));
+        sorted_release(removed);
+        removed = next;
+      }
+    }
+    result = mapped_wrap(box->file, added, removed, shadowed);
+    added = NULL;
+    removed = NULL;
+  }, [&]() {
+    sorted_release(added);
+    sorted_release(removed);
+  });
+  return result;
+}
+
+static Janet cfun_mapped_to_set(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto box = CAST_MAPPED(janet_getabstract(argv, 0, &mapped_set_type));
+  // Reading a corrupt file panics, so we collect into an array that the GC
+  // can free, and only build the set once every element has been read.
+  JanetArray *elements = janet_array(0);
+  mapped_for_each(box, [&](Janet key, Janet value) {
+    (void) value;
+    janet_array_push(elements, key);
+  });
+  auto set = NEW_SET();
+  auto transient = set->transient();
+  set_insert_all(transient, elements->data, elements->count);
+  *set = transient.persistent();
+  return janet_wrap_abstract(set);
+}
+
+static Janet cfun_mapped_to_map(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto box = CAST_MAPPED(janet_getabstract(argv, 0, &mapped_map_type));
+  // Like mapped/to-set.
+  JanetArray *kvs = janet_array(0);
+  mapped_for_each(box, [&](Janet key, Janet value) {
+    janet_array_push(kvs, key);
+    janet_array_push(kvs, value);
+  });
+  auto map = NEW_MAP();
+  auto transient = map->transient();
+  map_set_all(transient, kvs->data, kvs->count / 2);
+  *map = transient.persistent();
+  return janet_wrap_abstract(map);
+}
+
+static const JanetReg mapped_cfuns[] = {
+  {"mapped/write", cfun_mapped_write, "(mapped/write path coll)\n\n"
+    "Writes a jimmy set or map to a file that `mapped/open` can map into memory. "
+    "Keys and values must be `nil`, booleans, numbers, strings, keywords or symbols, and keys cannot be `nil`. "
+    "The file is written next to `path` and then renamed over it, so processes that have the old file open keep seeing the old contents."},
+  {"mapped/open", cfun_mapped_open, "(mapped/open path)\n\n"
+    "Maps a file written by `mapped/write` into memory, read-only, and returns it as a mapped set or map. "
+    "This only reads the file's header: lookups and iteration read the rest lazily, "
+    "and processes that open the same file share its pages. Mapped collections are compared by identity. "
+    "Not supported on Windows."},
+  {"mapped/add", cfun_mapped_add, "(mapped/add set & xs)\n\n"
+    "Returns a new mapped set with all of the subsequent arguments added. "
+    "Edits are kept in memory, and never change the file."},
+  {"mapped/put", cfun_mapped_put, "(mapped/put map & kvs)\n\n"
+    "Returns a new mapped map with all of the subsequent key-value pairs added, replacing any existing values. "
+    "Edits are kept in memory, and never change the file."},
+  {"mapped/remove", cfun_mapped_remove, "(mapped/remove coll & keys)\n\n"
+    "Returns a new mapped set or map without any of the given keys."},
+  {"mapped/to-set", cfun_mapped_to_set, "(mapped/to-set set)\n\n"
+    "Reads every element of a mapped set, including edits, into a new jimmy set."},
+  {"mapped/to-map", cfun_mapped_to_map, "(mapped/to-map map)\n\n"
+    "Reads every entry of a mapped map, including edits, into a new jimmy map."},
+  {NULL, NULL, NULL}
+};
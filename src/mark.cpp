@@ -0,0 +1,178 @@
+#include <immer/detail/hamts/node.hpp>
+#include <immer/detail/rbts/node.hpp>
+#include <unordered_set>
+
+// Persistent versions of a collection share most of their nodes, so walking
+// every element of every live collection marks the same values over and over
+// again. Instead we remember which immer nodes we have already marked during
+// the current collection, and skip subtrees that we've already seen.
+//
+// Janet does not tell abstract types when a collection starts, so we detect
+// collection boundaries with a canary: an unreachable abstract whose finalizer
+// runs during the sweep phase of the next collection. While a canary is alive,
+// every mark since the last sweep belongs to the same collection, so it's safe
+// to skip nodes that we've already visited. If there is no canary -- because
+// jimmy has not allocated anything since the last sweep -- we can't tell one
+// collection from the next, so we mark every element.
+
+typedef struct {
+  std::unordered_set<const void *> visited;
+  bool armed;
+} MarkState;
+
+static thread_local MarkState mark_state;
+
+static int mark_canary_gc(void *data, size_t len) {
+  (void) data;
+  (void) len;
+  mark_state.visited.clear();
+  mark_state.armed = false;
+  return 0;
+}
+
+static const JanetAbstractType mark_canary_type = {
+  .name = "jimmy/gc-canary",
+  .gc = mark_canary_gc,
+  .gcmark = NULL,
+  .get = NULL,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = NULL,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+// Called whenever jimmy allocates a collection. This is never called during
+// the mark phase, because you can't allocate during the mark phase.
+static void mark_arm() {
+  if (!mark_state.armed) {
+    janet_abstract(&mark_canary_type, 0);
+    mark_state.armed = true;
+  }
+}
+
+// Returns true the first time it sees a node during a collection.
+static bool mark_visit(const void *node) {
+  return !mark_state.armed || mark_state.visited.insert(node).second;
+}
+
+template <typename T, typename Hash, typename Equal, typename MemoryPolicy,
+          immer::detail::hamts::bits_t B, typename Fn>
+static void mark_champ_node(
+  immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *node,
+  immer::detail::hamts::count_t depth,
+  Fn &&mark_value
+) {
+  if (!mark_visit(node)) {
+    return;
+  }
+  if (depth < immer::detail::hamts::max_depth<B>) {
+    auto values = node->values();
+    auto value_count = immer::detail::hamts::popcount(node->datamap());
+    for (immer::detail::hamts::count_t i = 0; i < value_count; i++) {
+      mark_value(values[i]);
+    }
+    auto children = node->children();
+    auto child_count = immer::detail::hamts::popcount(node->nodemap());
+    for (immer::detail::hamts::count_t i = 0; i < child_count; i++) {
+      mark_champ_node(children[i], depth + 1, mark_value);
+    }
+  } else {
+    auto values = node->collisions();
+    auto value_count = node->collision_count();
+    for (immer::detail::hamts::count_t i = 0; i < value_count; i++) {
+      mark_value(values[i]);
+    }
+  }
+}
+
+// Works for both immer::set and immer::map.
+template <typename Champ, typename Fn>
+static void mark_champ(const Champ &champ, Fn &&mark_value) {
+  mark_champ_node(champ.root, 0, mark_value);
+}
+
+template <typename T, typename Node>
+static void mark_rbts_leaf(Node *node, size_t count) {
+  if (!mark_visit(node)) {
+    return;
+  }
+  T *values = node->leaf();
+  for (size_t i = 0; i < count; i++) {
+    janet_mark(values[i]);
+  }
+}
+
+// `count` is the number of elements under this node. Every child of a
+// regular node is full except for the last one.
+template <typename T, immer::detail::rbts::bits_t B, immer::detail::rbts::bits_t BL, typename Node>
+static void mark_rbts_inner(Node *node, immer::detail::rbts::shift_t shift, size_t count) {
+  if (!mark_visit(node)) {
+    return;
+  }
+  Node **children = node->inner();
+  size_t child_size = size_t(1) << shift;
+  for (size_t i = 0; count > 0; i++) {
+    size_t child_count = count < child_size ? count : child_size;
+    if (shift == BL) {
+      mark_rbts_leaf<T>(children[i], child_count);
+    } else {
+      mark_rbts_inner<T, B, BL>(children[i], shift - B, child_count);
+    }
+    count -= child_count;
+  }
+}
+
+// Concatenation and slicing leave relaxed nodes, which can have children of
+// any size and record how many elements are under each of them. Regular nodes
+// only ever have regular children, so once we reach one we can switch to the
+// simpler walk above.
+template <typename T, immer::detail::rbts::bits_t B, immer::detail::rbts::bits_t BL, typename Node>
+static void mark_rrbts_inner(Node *node, immer::detail::rbts::shift_t shift, size_t count) {
+  auto relaxed = node->relaxed();
+  if (relaxed == nullptr) {
+    mark_rbts_inner<T, B, BL>(node, shift, count);
+    return;
+  }
+  if (!mark_visit(node)) {
+    return;
+  }
+  Node **children = node->inner();
+  size_t previous_size = 0;
+  for (immer::detail::rbts::count_t i = 0; i < relaxed->d.count; i++) {
+    size_t child_count = relaxed->d.sizes[i] - previous_size;
+    if (shift == BL) {
+      mark_rbts_leaf<T>(children[i], child_count);
+    } else {
+      mark_rrbts_inner<T, B, BL>(children[i], shift - B, child_count);
+    }
+    previous_size = relaxed->d.sizes[i];
+  }
+}
+
+template <typename Vector>
+static void mark_vector(const Vector &vector) {
+  using T = typename Vector::value_type;
+  auto &impl = vector.impl();
+  auto tail_offset = impl.tail_offset();
+  mark_rrbts_inner<T, Vector::bits, Vector::bits_leaf>(impl.root, impl.shift, tail_offset);
+  mark_rbts_leaf<T>(impl.tail, impl.size - tail_offset);
+}
+
+// Transients don't expose their nodes, but a persistent snapshot of one shares
+// all of them. Taking one only touches reference counts, and the transient
+// keeps editing in place once the snapshot is gone.
+template <typename Transient, typename Fn>
+static void mark_champ_transient(Transient &transient, Fn &&mark_value) {
+  auto snapshot = transient.persistent();
+  mark_champ(snapshot.impl(), mark_value);
+}
+
+template <typename Transient>
+static void mark_vector_transient(Transient &transient) {
+  auto snapshot = transient.persistent();
+  mark_vector(snapshot);
+}
@@ -0,0 +1,172 @@
+#include <vector>
+
+// Versions of a collection share most of their structure, so when a single
+// `marshal` call writes several versions of the same collection, we write
+// the later ones as a delta against an earlier one. Unmarshaling rebuilds
+// them from the earlier version, so the results share structure again, and
+// only the entries that changed are hashed and inserted.
+//
+// Deltas refer to earlier collections by the order in which they were
+// written, so both sides keep a per-thread history of the collections they've
+// seen during the current call. The history doesn't own them: while
+// marshaling, every collection written so far is reachable from the value
+// being written, and while unmarshaling, Janet keeps every value it has read
+// for back-references, so they all outlive the call. Janet doesn't tell abstract types when a
+// call begins, so every collection writes a per-thread sentinel before its
+// contents. Janet writes a value in full only the first time it appears in a
+// call, and as a back-reference after that, so the sentinel's own hooks run
+// exactly once per call, before any collection reads the history. That's
+// where we forget the previous call.
+
+// Only the most recent candidates are considered as a base, so that marshaling
+// many unrelated collections doesn't diff each one against all the others.
+// Each diff gives up once the delta would be too large to be worth it.
+static const size_t MARSHAL_BASE_CANDIDATES = 4;
+
+// Sets and maps used to start with their size, and vecs with their size as a
+// size_t, none of which can be negative. So collections now start with this
+// instead, and anything else is read the old way.
+static const int32_t MARSHAL_FORMAT = -1;
+
+static thread_local uint64_t marshal_generation = 0;
+static thread_local uint64_t unmarshal_generation = 0;
+static thread_local bool marshal_sentinel_exists = false;
+static thread_local Janet marshal_sentinel;
+
+static void marshal_sentinel_marshal(void *data, JanetMarshalContext *ctx) {
+  janet_marshal_abstract(ctx, data);
+  marshal_generation++;
+}
+
+static void *marshal_sentinel_unmarshal(JanetMarshalContext *ctx) {
+  unmarshal_generation++;
+  return janet_unmarshal_abstract(ctx, 0);
+}
+
+// The marshal-sentinel abstract type is not exposed to the user.
+static const JanetAbstractType marshal_sentinel_type = {
+  .name = "jimmy/marshal-sentinel",
+  .gc = NULL,
+  .gcmark = NULL,
+  .get = NULL,
+  .put = NULL,
+  .marshal = marshal_sentinel_marshal,
+  .unmarshal = marshal_sentinel_unmarshal,
+  .tostring = NULL,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+static void marshal_begin(JanetMarshalContext *ctx) {
+  if (!marshal_sentinel_exists) {
+    marshal_sentinel = janet_wrap_abstract(janet_abstract(&marshal_sentinel_type, 0));
+    janet_gcroot(marshal_sentinel);
+    marshal_sentinel_exists = true;
+  }
+  janet_marshal_janet(ctx, marshal_sentinel);
+}
+
+// A blob without a sentinel would leave the history of an earlier call in
+// place, and a delta could then refer to a collection from that call, which
+// might have been collected since.
+static void unmarshal_begin(JanetMarshalContext *ctx) {
+  Janet sentinel = janet_unmarshal_janet(ctx);
+  if (!janet_checkabstract(sentinel, &marshal_sentinel_type)) {
+    janet_panicf("expected marshal sentinel, got %v", sentinel);
+  }
+}
+
+// Returns the size of a set or map written in the old format, or
+// MARSHAL_FORMAT.
+static int32_t unmarshal_format(JanetMarshalContext *ctx) {
+  int32_t format = janet_unmarshal_int(ctx);
+  if (format < 0 && format != MARSHAL_FORMAT) {
+    janet_panicf("invalid collection format %d", format);
+  }
+  return format;
+}
+
+// The collections of one type that have been written or read so far during
+// the current call. Pointers from earlier calls are never looked at again.
+template <typename T>
+struct MarshalHistory {
+  uint64_t generation;
+  std::vector<const T *> values;
+
+  std::vector<const T *> &current(uint64_t now) {
+    if (generation != now) {
+      values.clear();
+      generation = now;
+    }
+    return values;
+  }
+};
+
+// Marks a collection written in full, rather than as a delta.
+static const int32_t MARSHAL_NO_BASE = -1;
+// Marks a collection whose root was passed by pointer; see `marshal_share`.
+static const int32_t MARSHAL_SHARED = -2;
+
+static int32_t unmarshal_base(JanetMarshalContext *ctx, size_t history_size) {
+  int32_t base = janet_unmarshal_int(ctx);
+  if (base == MARSHAL_SHARED && (ctx->flags & JANET_MARSHAL_UNSAFE)) {
+    return base;
+  }
+  if (base != MARSHAL_NO_BASE && (base < 0 || static_cast<size_t>(base) >= history_size)) {
+    janet_panicf("invalid delta base %d", base);
+  }
+  return base;
+}
+
+// Janet marshals values that it sends to another thread of the same process
+// with JANET_MARSHAL_UNSAFE, which lets us pass the root of a collection by
+// pointer, with an extra reference, instead of copying it. The other thread
+// then shares every node with us, so this needs atomic reference counts, and
+// the elements can't point into our thread's heap. Only nil, booleans and
+// numbers are stored inline in a Janet value; collections that contain
+// anything else are copied as usual.
+//
+// The extra reference belongs to the message, and is only released when the
+// message is unmarshaled. Janet frees a message that is never delivered, like
+// one still sitting in a thread channel when its thread exits, without
+// unmarshaling it, so the collection it points to is never freed. Nothing
+// tells us when that happens, so there's no way to avoid it here.
+static bool marshal_immediate(Janet x) {
+  return janet_checktypes(x, JANET_TFLAG_NIL | JANET_TFLAG_BOOLEAN | JANET_TFLAG_NUMBER);
+}
+
+template <typename T, typename Pred>
+static bool marshal_every(const T &collection, Pred &&pred) {
+  for (const auto &x : collection) {
+    if (!pred(x)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef JIMMY_THREAD_SAFE
+static bool marshal_shareable(JanetMarshalContext *ctx) {
+  return (ctx->flags & JANET_MARSHAL_UNSAFE) != 0;
+}
+#else
+static bool marshal_shareable(JanetMarshalContext *ctx) {
+  (void) ctx;
+  return false;
+}
+#endif
+
+template <typename T>
+static void marshal_share(JanetMarshalContext *ctx, const T &collection) {
+  janet_marshal_int(ctx, MARSHAL_SHARED);
+  janet_marshal_ptr(ctx, new T(collection));
+}
+
+template <typename T>
+static void unmarshal_share(JanetMarshalContext *ctx, T &out) {
+  auto shared = static_cast<T *>(janet_unmarshal_ptr(ctx));
+  out = *shared;
+  delete shared;
+}
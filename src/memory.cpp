@@ -0,0 +1,50 @@
+#include <immer/memory_policy.hpp>
+
+// immer allocates its nodes outside of Janet's heap, so by default Janet's GC
+// only sees the few bytes of the abstract that points to the root of a
+// collection. A fiber building large temporary collections could use
+// gigabytes of memory before Janet decided to run a collection. Instead, we
+// allocate nodes with Janet's allocator and count them towards Janet's GC
+// pressure, so dead collections are collected in proportion to the memory
+// that they hold.
+//
+// Blocks recycled through immer's free lists are not reported twice, the same
+// way that Janet only counts fresh allocations towards its next collection.
+struct JanetHeap {
+  template <typename... Tags>
+  static void *allocate(size_t size, Tags...) {
+    void *result = janet_malloc(size);
+    if (result == NULL) {
+      JANET_OUT_OF_MEMORY;
+    }
+    janet_gcpressure(size);
+    return result;
+  }
+
+  template <typename... Tags>
+  static void deallocate(size_t size, void *data, Tags...) {
+    (void) size;
+    janet_free(data);
+  }
+};
+
+// A Janet VM is single-threaded, and jimmy collections only cross threads by
+// being marshaled, so by default we don't pay for atomic reference counts.
+// immer's free list heap keeps a thread-local free list in front of the shared
+// one, so recycling nodes doesn't synchronize either.
+//
+// Build with JIMMY_THREAD_SAFE set in the environment to get immer's default
+// thread-safe policy back, e.g. to compare the two with bench/refcount.janet.
+#ifdef JIMMY_THREAD_SAFE
+typedef immer::memory_policy<
+  immer::free_list_heap_policy<JanetHeap>,
+  immer::default_refcount_policy,
+  immer::default_lock_policy
+> MemoryPolicy;
+#else
+typedef immer::memory_policy<
+  immer::free_list_heap_policy<JanetHeap>,
+  immer::unsafe_refcount_policy,
+  immer::no_lock_policy
+> MemoryPolicy;
+#endif
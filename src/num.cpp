@@ -0,0 +1,738 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Persistent vectors of unboxed doubles or 64-bit integers. Leaves hold raw
+// numbers, so the kernels below run over contiguous arrays without any type
+// checks or callbacks. Reductions keep four independent accumulators so that
+// the compiler can vectorize them; elementwise operations read their inputs a
+// leaf at a time and push their results straight into a new vector.
+
+template <typename T>
+using NumVec = immer::flex_vector<T, MemoryPolicy>;
+
+typedef NumVec<double> F64Vec;
+typedef NumVec<int64_t> I64Vec;
+
+template <typename T> static const JanetAbstractType *num_type();
+
+template <typename T> static Janet num_wrap(T x);
+template <> Janet num_wrap<double>(double x) { return janet_wrap_number(x); }
+template <> Janet num_wrap<int64_t>(int64_t x) { return janet_wrap_s64(x); }
+
+template <typename T> static T num_unwrap(Janet x);
+template <> double num_unwrap<double>(Janet x) {
+  if (!janet_checktype(x, JANET_NUMBER)) {
+    janet_panicf("expected number, got %v", x);
+  }
+  return janet_unwrap_number(x);
+}
+template <> int64_t num_unwrap<int64_t>(Janet x) { return janet_unwrap_s64(x); }
+
+template <typename T>
+static NumVec<T> *num_new() {
+  return new (janet_abstract(num_type<T>(), sizeof(NumVec<T>))) NumVec<T>();
+}
+
+template <typename T>
+static int num_gc(void *data, size_t len) {
+  (void) len;
+  static_cast<NumVec<T> *>(data)->~NumVec<T>();
+  return 0;
+}
+
+static void num_push_element(JanetBuffer *buffer, double x) {
+  janet_pretty(buffer, 0, 0, janet_wrap_number(x));
+}
+
+static void num_push_element(JanetBuffer *buffer, int64_t x) {
+  char digits[32];
+  snprintf(digits, sizeof(digits), "%lld", static_cast<long long>(x));
+  janet_buffer_push_cstring(buffer, digits);
+}
+
+template <typename T>
+static void num_tostring(void *data, JanetBuffer *buffer) {
+  auto vec = static_cast<NumVec<T> *>(data);
+  janet_buffer_push_cstring(buffer, "[");
+  int first = 1;
+  for (auto el : *vec) {
+    if (first) {
+      first = 0;
+    } else {
+      janet_buffer_push_cstring(buffer, " ");
+    }
+    num_push_element(buffer, el);
+  }
+  janet_buffer_push_cstring(buffer, "]");
+}
+
+template <typename T>
+static Janet num_length(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto vec = static_cast<NumVec<T> *>(janet_unwrap_abstract(argv[0]));
+  return janet_wrap_number(static_cast<double>(vec->size()));
+}
+
+static const JanetMethod f64vec_methods[] = {
+  {"length", num_length<double>},
+  {NULL, NULL}
+};
+
+static const JanetMethod i64vec_methods[] = {
+  {"length", num_length<int64_t>},
+  {NULL, NULL}
+};
+
+template <typename T>
+static int num_get(void *data, Janet key, Janet *out) {
+  auto vec = static_cast<NumVec<T> *>(data);
+  if (janet_checksize(key)) {
+    size_t index = static_cast<size_t>(janet_unwrap_number(key));
+    if (index >= vec->size()) {
+      return 0;
+    }
+    *out = num_wrap<T>((*vec)[index]);
+    return 1;
+  } else if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key),
+      num_type<T>() == num_type<double>() ? f64vec_methods : i64vec_methods, out);
+  } else {
+    return 0;
+  }
+}
+
+template <typename T>
+static Janet num_next(void *data, Janet key) {
+  auto vec = static_cast<NumVec<T> *>(data);
+  if (janet_checktype(key, JANET_NIL)) {
+    if (!vec->empty()) {
+      return janet_wrap_integer(0);
+    }
+  } else if (janet_checksize(key)) {
+    size_t index = janet_unwrap_number(key);
+    if (index + 1 < vec->size()) {
+      return janet_wrap_integer(index + 1);
+    }
+  }
+  return janet_wrap_nil();
+}
+
+template <typename T>
+static Janet num_call(void *data, int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  size_t index = janet_getsize(argv, 0);
+  auto vec = static_cast<NumVec<T> *>(data);
+  if (index >= vec->size()) {
+    janet_panicf("expected integer key in range [0, %d), got %v", vec->size(), argv[0]);
+  }
+  return num_wrap<T>((*vec)[index]);
+}
+
+template <typename T>
+static int num_compare(void *data1, void *data2) {
+  auto vec1 = static_cast<NumVec<T> *>(data1);
+  auto vec2 = static_cast<NumVec<T> *>(data2);
+  if (*vec1 == *vec2) {
+    return 0;
+  }
+  return vec1 > vec2 ? 1 : -1;
+}
+
+template <typename T>
+static int32_t num_hash(void *data, size_t len) {
+  (void) len;
+  auto vec = static_cast<NumVec<T> *>(data);
+  uint32_t hash = 0x2f0b3e1d;
+  for (auto el : *vec) {
+    // -0 and 0 are equal, but their bits aren't. Adding 0 turns -0 into 0,
+    // like Janet does before it hashes a number.
+    T normalized = el + T(0);
+    int64_t bits;
+    memcpy(&bits, &normalized, sizeof(bits));
+    hash = hash_mix(hash, static_cast<int32_t>(bits ^ (bits >> 32)));
+  }
+  return static_cast<int32_t>(hash);
+}
+
+// Doubles are marshaled by their bit pattern, so they round-trip exactly.
+template <typename T>
+static void num_marshal(void *data, JanetMarshalContext *ctx) {
+  janet_marshal_abstract(ctx, data);
+  auto vec = static_cast<NumVec<T> *>(data);
+  janet_marshal_size(ctx, vec->size());
+  for (auto el : *vec) {
+    int64_t bits;
+    memcpy(&bits, &el, sizeof(bits));
+    janet_marshal_int64(ctx, bits);
+  }
+}
+
+template <typename T>
+static void *num_unmarshal(JanetMarshalContext *ctx) {
+  auto vec = new (janet_unmarshal_abstract(ctx, sizeof(NumVec<T>))) NumVec<T>();
+  auto transient = vec->transient();
+  size_t size = janet_unmarshal_size(ctx);
+  for (size_t i = 0; i < size; i++) {
+    int64_t bits = janet_unmarshal_int64(ctx);
+    T el;
+    memcpy(&el, &bits, sizeof(el));
+    transient.push_back(el);
+  }
+  *vec = transient.persistent();
+  return vec;
+}
+
+static const JanetAbstractType f64vec_type = {
+  .name = "jimmy/f64vec",
+  .gc = num_gc<double>,
+  .gcmark = NULL,
+  .get = num_get<double>,
+  .put = NULL,
+  .marshal = num_marshal<double>,
+  .unmarshal = num_unmarshal<double>,
+  .tostring = num_tostring<double>,
+  .compare = num_compare<double>,
+  .hash = num_hash<double>,
+  .next = num_next<double>,
+  .call = num_call<double>,
+};
+
+static const JanetAbstractType i64vec_type = {
+  .name = "jimmy/i64vec",
+  .gc = num_gc<int64_t>,
+  .gcmark = NULL,
+  .get = num_get<int64_t>,
+  .put = NULL,
+  .marshal = num_marshal<int64_t>,
+  .unmarshal = num_unmarshal<int64_t>,
+  .tostring = num_tostring<int64_t>,
+  .compare = num_compare<int64_t>,
+  .hash = num_hash<int64_t>,
+  .next = num_next<int64_t>,
+  .call = num_call<int64_t>,
+};
+
+template <> const JanetAbstractType *num_type<double>() { return &f64vec_type; }
+template <> const JanetAbstractType *num_type<int64_t>() { return &i64vec_type; }
+
+// Converting a double to an integer is undefined unless it fits, so like
+// `core/s64`, we only convert integers in range.
+template <typename T> static T num_from_f64(double x);
+template <> double num_from_f64<double>(double x) { return x; }
+template <> int64_t num_from_f64<int64_t>(double x) {
+  if (!(x >= -9223372036854775808.0 && x < 9223372036854775808.0) || static_cast<double>(static_cast<int64_t>(x)) != x) {
+    janet_panicf("expected integer in 64-bit range, got %v", janet_wrap_number(x));
+  }
+  return static_cast<int64_t>(x);
+}
+
+// Reads every element first, so that a bad element panics before we've
+// built any C++ objects.
+template <typename T>
+static Janet num_of(Janet iterable) {
+  const Janet *items;
+  int32_t length;
+  auto vec = num_new<T>();
+  if (janet_indexed_view(iterable, &items, &length)) {
+    for (int32_t i = 0; i < length; i++) {
+      num_unwrap<T>(items[i]);
+    }
+    auto transient = vec->transient();
+    for (int32_t i = 0; i < length; i++) {
+      transient.push_back(num_unwrap<T>(items[i]));
+    }
+    *vec = transient.persistent();
+  } else if (janet_checkabstract(iterable, &vec_type)) {
+    auto source = CAST_VEC(janet_unwrap_abstract(iterable));
+    for (auto el : *source) {
+      num_unwrap<T>(el);
+    }
+    auto transient = vec->transient();
+    for (auto el : *source) {
+      transient.push_back(num_unwrap<T>(el));
+    }
+    *vec = transient.persistent();
+  } else if (janet_checkabstract(iterable, &f64vec_type)) {
+    auto source = static_cast<F64Vec *>(janet_unwrap_abstract(iterable));
+    for (auto el : *source) {
+      num_from_f64<T>(el);
+    }
+    auto transient = vec->transient();
+    for (auto el : *source) {
+      transient.push_back(num_from_f64<T>(el));
+    }
+    *vec = transient.persistent();
+  } else if (janet_checkabstract(iterable, &i64vec_type)) {
+    auto source = static_cast<I64Vec *>(janet_unwrap_abstract(iterable));
+    auto transient = vec->transient();
+    for (auto el : *source) {
+      transient.push_back(static_cast<T>(el));
+    }
+    *vec = transient.persistent();
+  } else {
+    janet_panicf("expected array, tuple or vector, got %v", iterable);
+  }
+  return janet_wrap_abstract(vec);
+}
+
+static Janet cfun_num_f64(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return num_of<double>(argv[0]);
+}
+
+static Janet cfun_num_i64(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return num_of<int64_t>(argv[0]);
+}
+
+// Returns a new vector of `fn` applied to every element of `source`.
+template <typename R, typename T, typename Fn>
+static NumVec<R> *num_map(const NumVec<T> &source, Fn &&fn) {
+  auto vec = num_new<R>();
+  auto transient = vec->transient();
+  immer::for_each_chunk(source, [&](const T *first, const T *last) {
+    for (; first != last; first++) {
+      transient.push_back(fn(*first));
+    }
+  });
+  *vec = transient.persistent();
+  return vec;
+}
+
+// Like num_map, but `fn` takes an element of `a` and the element of `b` at
+// the same index. The vectors must have the same length.
+template <typename T, typename Fn>
+static NumVec<T> *num_zip(const NumVec<T> &a, const NumVec<T> &b, Fn &&fn) {
+  auto vec = num_new<T>();
+  auto transient = vec->transient();
+  auto other = b.begin();
+  immer::for_each_chunk(a, [&](const T *first, const T *last) {
+    for (; first != last; first++, other++) {
+      transient.push_back(fn(*first, *other));
+    }
+  });
+  *vec = transient.persistent();
+  return vec;
+}
+
+// Integer kernels would overflow into undefined behavior, so instead they
+// wrap around and set `overflow`. We can't panic from inside a kernel, which
+// would skip the destructors of whatever it's building, so callers check the
+// flag once everything is cleaned up.
+
+static double num_add(double a, double b, bool &overflow) {
+  (void) overflow;
+  return a + b;
+}
+
+static int64_t num_add(int64_t a, int64_t b, bool &overflow) {
+  if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+    overflow = true;
+  }
+  return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+static double num_mul(double a, double b, bool &overflow) {
+  (void) overflow;
+  return a * b;
+}
+
+static int64_t num_mul(int64_t a, int64_t b, bool &overflow) {
+  if (a == 0 || b == 0) {
+    return 0;
+  }
+  auto product = static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+  if ((a == -1 && b == INT64_MIN) || (b == -1 && a == INT64_MIN) || product / b != a) {
+    overflow = true;
+  }
+  return product;
+}
+
+static void num_check_overflow(bool overflow) {
+  if (overflow) {
+    janet_panic("integer overflow");
+  }
+}
+
+// A running sum. Reductions split their input across four of these, so
+// which partial sums they compute is arbitrary. The integer version wraps
+// around instead, and counts how many times it wrapped in each direction,
+// so that it only overflows if the total doesn't fit.
+template <typename T>
+struct NumSum {
+  T value = 0;
+
+  void add(T x) {
+    value += x;
+  }
+
+  void merge(const NumSum &other) {
+    value += other.value;
+  }
+
+  T total(bool &overflow) const {
+    (void) overflow;
+    return value;
+  }
+};
+
+template <>
+struct NumSum<int64_t> {
+  uint64_t value = 0;
+  int64_t wraps = 0;
+
+  void add(int64_t x) {
+    auto before = static_cast<int64_t>(value);
+    value += static_cast<uint64_t>(x);
+    auto after = static_cast<int64_t>(value);
+    if (x > 0 && after < before) {
+      wraps++;
+    } else if (x < 0 && after > before) {
+      wraps--;
+    }
+  }
+
+  void merge(const NumSum &other) {
+    add(static_cast<int64_t>(other.value));
+    wraps += other.wraps;
+  }
+
+  int64_t total(bool &overflow) const {
+    if (wraps != 0) {
+      overflow = true;
+    }
+    return static_cast<int64_t>(value);
+  }
+};
+
+template <typename T>
+static T num_sum(const NumVec<T> &vec, bool &overflow) {
+  NumSum<T> total;
+  immer::for_each_chunk(vec, [&](const T *first, const T *last) {
+    NumSum<T> acc0, acc1, acc2, acc3;
+    for (; first + 4 <= last; first += 4) {
+      acc0.add(first[0]);
+      acc1.add(first[1]);
+      acc2.add(first[2]);
+      acc3.add(first[3]);
+    }
+    for (; first != last; first++) {
+      acc0.add(*first);
+    }
+    total.merge(acc0);
+    total.merge(acc1);
+    total.merge(acc2);
+    total.merge(acc3);
+  });
+  return total.total(overflow);
+}
+
+template <typename T, typename Pick>
+static T num_extreme(const NumVec<T> &vec, Pick &&pick) {
+  T best = vec[0];
+  immer::for_each_chunk(vec, [&](const T *first, const T *last) {
+    T acc0 = best, acc1 = best, acc2 = best, acc3 = best;
+    for (; first + 4 <= last; first += 4) {
+      acc0 = pick(acc0, first[0]);
+      acc1 = pick(acc1, first[1]);
+      acc2 = pick(acc2, first[2]);
+      acc3 = pick(acc3, first[3]);
+    }
+    for (; first != last; first++) {
+      acc0 = pick(acc0, *first);
+    }
+    best = pick(pick(acc0, acc1), pick(acc2, acc3));
+  });
+  return best;
+}
+
+// The vectors must have the same length.
+template <typename T>
+static T num_dot(const NumVec<T> &a, const NumVec<T> &b, bool &overflow) {
+  NumSum<T> acc0, acc1, acc2, acc3;
+  auto other = b.begin();
+  immer::for_each_chunk(a, [&](const T *first, const T *last) {
+    for (; first + 4 <= last; first += 4) {
+      acc0.add(num_mul(first[0], *other++, overflow));
+      acc1.add(num_mul(first[1], *other++, overflow));
+      acc2.add(num_mul(first[2], *other++, overflow));
+      acc3.add(num_mul(first[3], *other++, overflow));
+    }
+    for (; first != last; first++) {
+      acc0.add(num_mul(*first, *other++, overflow));
+    }
+  });
+  acc0.merge(acc1);
+  acc0.merge(acc2);
+  acc0.merge(acc3);
+  return acc0.total(overflow);
+}
+
+template <typename T>
+static NumVec<T> *num_getvec(Janet *argv, int32_t n) {
+  return static_cast<NumVec<T> *>(janet_getabstract(argv, n, num_type<T>()));
+}
+
+static void num_panic_type(Janet *argv, int32_t n) {
+  janet_panicf("bad slot #%d, expected jimmy/f64vec or jimmy/i64vec, got %v", n, argv[n]);
+}
+
+static Janet cfun_num_sum(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  bool overflow = false;
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_wrap<double>(num_sum(*num_getvec<double>(argv, 0), overflow));
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    auto sum = num_sum(*num_getvec<int64_t>(argv, 0), overflow);
+    num_check_overflow(overflow);
+    return num_wrap<int64_t>(sum);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+template <typename T>
+static Janet num_min_max(Janet *argv, bool max) {
+  auto vec = num_getvec<T>(argv, 0);
+  if (vec->empty()) {
+    return janet_wrap_nil();
+  }
+  if (max) {
+    return num_wrap<T>(num_extreme(*vec, [](T a, T b) { return a < b ? b : a; }));
+  } else {
+    return num_wrap<T>(num_extreme(*vec, [](T a, T b) { return b < a ? b : a; }));
+  }
+}
+
+static Janet cfun_num_min(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_min_max<double>(argv, false);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_min_max<int64_t>(argv, false);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+static Janet cfun_num_max(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_min_max<double>(argv, true);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_min_max<int64_t>(argv, true);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+// Both vectors must have the same type and length. Checked before anything
+// is allocated.
+template <typename T>
+static NumVec<T> *num_get_partner(Janet *argv, NumVec<T> *a) {
+  auto b = num_getvec<T>(argv, 1);
+  if (a->size() != b->size()) {
+    janet_panicf("expected vectors of the same length, got %d and %d", a->size(), b->size());
+  }
+  return b;
+}
+
+template <typename T>
+static Janet num_dot_typed(Janet *argv) {
+  auto a = num_getvec<T>(argv, 0);
+  auto b = num_get_partner<T>(argv, a);
+  bool overflow = false;
+  T dot = num_dot(*a, *b, overflow);
+  num_check_overflow(overflow);
+  return num_wrap<T>(dot);
+}
+
+static Janet cfun_num_dot(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_dot_typed<double>(argv);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_dot_typed<int64_t>(argv);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+template <typename T>
+static Janet num_scale_typed(Janet *argv) {
+  auto vec = num_getvec<T>(argv, 0);
+  T k = num_unwrap<T>(argv[1]);
+  bool overflow = false;
+  auto result = num_map<T>(*vec, [&](T el) { return num_mul(el, k, overflow); });
+  num_check_overflow(overflow);
+  return janet_wrap_abstract(result);
+}
+
+static Janet cfun_num_scale(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_scale_typed<double>(argv);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_scale_typed<int64_t>(argv);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+// `b` can be another vector of the same type and length, or a scalar that
+// gets added to every element.
+template <typename T>
+static Janet num_add_typed(Janet *argv) {
+  auto a = num_getvec<T>(argv, 0);
+  bool overflow = false;
+  NumVec<T> *result;
+  if (janet_checkabstract(argv[1], num_type<T>())) {
+    auto b = num_get_partner<T>(argv, a);
+    result = num_zip(*a, *b, [&](T x, T y) { return num_add(x, y, overflow); });
+  } else {
+    T k = num_unwrap<T>(argv[1]);
+    result = num_map<T>(*a, [&](T el) { return num_add(el, k, overflow); });
+  }
+  num_check_overflow(overflow);
+  return janet_wrap_abstract(result);
+}
+
+static Janet cfun_num_add(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_add_typed<double>(argv);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_add_typed<int64_t>(argv);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+typedef enum {
+  NumLess,
+  NumLessEqual,
+  NumGreater,
+  NumGreaterEqual,
+  NumEqual,
+  NumNotEqual,
+} NumComparison;
+
+static NumComparison num_getcomparison(Janet *argv, int32_t n) {
+  JanetKeyword op = janet_getkeyword(argv, n);
+  if (!janet_cstrcmp(op, "<")) return NumLess;
+  if (!janet_cstrcmp(op, "<=")) return NumLessEqual;
+  if (!janet_cstrcmp(op, ">")) return NumGreater;
+  if (!janet_cstrcmp(op, ">=")) return NumGreaterEqual;
+  if (!janet_cstrcmp(op, "=")) return NumEqual;
+  if (!janet_cstrcmp(op, "not=")) return NumNotEqual;
+  janet_panicf("expected one of :< :<= :> :>= := :not=, got %v", argv[n]);
+  return NumEqual;
+}
+
+template <typename T, typename Compare>
+static Janet num_mask_with(const NumVec<T> &vec, Compare &&compare) {
+  return janet_wrap_abstract(num_map<int64_t>(vec, [&](T x) { return compare(x) ? int64_t(1) : int64_t(0); }));
+}
+
+template <typename T>
+static Janet num_mask_typed(Janet *argv) {
+  auto vec = num_getvec<T>(argv, 0);
+  auto op = num_getcomparison(argv, 1);
+  T k = num_unwrap<T>(argv[2]);
+  switch (op) {
+  case NumLess: return num_mask_with(*vec, [=](T x) { return x < k; });
+  case NumLessEqual: return num_mask_with(*vec, [=](T x) { return x <= k; });
+  case NumGreater: return num_mask_with(*vec, [=](T x) { return x > k; });
+  case NumGreaterEqual: return num_mask_with(*vec, [=](T x) { return x >= k; });
+  case NumEqual: return num_mask_with(*vec, [=](T x) { return x == k; });
+  case NumNotEqual: return num_mask_with(*vec, [=](T x) { return x != k; });
+  }
+  return janet_wrap_nil();
+}
+
+static Janet cfun_num_mask(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_mask_typed<double>(argv);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_mask_typed<int64_t>(argv);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+template <typename T>
+static Janet num_to_vec_typed(Janet *argv) {
+  auto source = num_getvec<T>(argv, 0);
+  auto vec = NEW_VEC();
+  auto transient = vec->transient();
+  for (auto el : *source) {
+    transient.push_back(num_wrap<T>(el));
+  }
+  *vec = transient.persistent();
+  return janet_wrap_abstract(vec);
+}
+
+static Janet cfun_num_to_vec(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_to_vec_typed<double>(argv);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_to_vec_typed<int64_t>(argv);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+template <typename T>
+static Janet num_to_array_typed(Janet *argv) {
+  auto source = num_getvec<T>(argv, 0);
+  JanetArray *array = janet_array(static_cast<int32_t>(source->size()));
+  for (auto el : *source) {
+    array->data[array->count++] = num_wrap<T>(el);
+  }
+  return janet_wrap_array(array);
+}
+
+static Janet cfun_num_to_array(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  if (janet_checkabstract(argv[0], &f64vec_type)) {
+    return num_to_array_typed<double>(argv);
+  } else if (janet_checkabstract(argv[0], &i64vec_type)) {
+    return num_to_array_typed<int64_t>(argv);
+  }
+  num_panic_type(argv, 0);
+  return janet_wrap_nil();
+}
+
+static const JanetReg num_cfuns[] = {
+  {"vec/f64", cfun_num_f64, "(vec/f64 xs)\n\n"
+    "Returns a persistent vector of unboxed doubles, from an array, tuple, vec, f64vec or i64vec of numbers. "
+    "Use the `num/` functions to operate on it."},
+  {"vec/i64", cfun_num_i64, "(vec/i64 xs)\n\n"
+    "Returns a persistent vector of unboxed 64-bit integers, from an array, tuple, vec, f64vec or i64vec of numbers. "
+    "Like `int/s64`, this only accepts numbers that are integers in range. "
+    "Elements are returned as `core/s64` values. Use the `num/` functions to operate on it."},
+  {"num/sum", cfun_num_sum, "(num/sum nums)\n\n"
+    "Returns the sum of every element of an f64vec or i64vec. Panics if the sum of an i64vec overflows."},
+  {"num/min", cfun_num_min, "(num/min nums)\n\n"
+    "Returns the smallest element of an f64vec or i64vec, or `nil` if it is empty."},
+  {"num/max", cfun_num_max, "(num/max nums)\n\n"
+    "Returns the largest element of an f64vec or i64vec, or `nil` if it is empty."},
+  {"num/dot", cfun_num_dot, "(num/dot a b)\n\n"
+    "Returns the dot product of two vectors of the same type and length. Panics if an i64vec product overflows."},
+  {"num/scale", cfun_num_scale, "(num/scale nums k)\n\n"
+    "Returns a new vector with every element multiplied by `k`. Panics if an i64vec element overflows."},
+  {"num/add", cfun_num_add, "(num/add a b)\n\n"
+    "Returns the elementwise sum of two vectors of the same type and length. "
+    "If `b` is a number, it is added to every element of `a`. Panics if an i64vec element overflows."},
+  {"num/mask", cfun_num_mask, "(num/mask nums op x)\n\n"
+    "Compares every element to `x` with `op`, which can be one of `:<`, `:<=`, `:>`, `:>=`, `:=` or `:not=`, "
+    "and returns an i64vec with a 1 where the comparison holds and a 0 everywhere else."},
+  {"num/to-vec", cfun_num_to_vec, "(num/to-vec nums)\n\n"
+    "Returns a jimmy vec of every element of an f64vec or i64vec."},
+  {"num/to-array", cfun_num_to_array, "(num/to-array nums)\n\n"
+    "Returns an array of every element of an f64vec or i64vec."},
+  {NULL, NULL, NULL}
+};
@@ -0,0 +1,179 @@
+// Nested lookups and updates through any mix of jimmy maps, jimmy vecs and
+// Janet data structures. Updates rebuild only the spine of the path: every
+// persistent collection along the way is copied once, sharing all of its
+// other entries with the original, and mutable Janet tables and arrays are
+// updated in place, like Janet's own `put-in`.
+//
+// Everything that can panic happens before we touch any immer values, so
+// there is never a C++ object on the stack when we longjmp out.
+
+static Janet path_get(Janet ds, Janet key) {
+  if (janet_checkabstract(ds, &map_type)) {
+    auto map = CAST_MAP(janet_unwrap_abstract(ds));
+    const Janet *value = map->find(key);
+    return value == NULL ? janet_wrap_nil() : *value;
+  } else if (janet_checkabstract(ds, &vec_type)) {
+    auto vec = CAST_VEC(janet_unwrap_abstract(ds));
+    if (!janet_checksize(key)) {
+      return janet_wrap_nil();
+    }
+    size_t index = static_cast<size_t>(janet_unwrap_number(key));
+    return index < vec->size() ? (*vec)[index] : janet_wrap_nil();
+  } else if (janet_checktype(ds, JANET_NIL)) {
+    return ds;
+  } else {
+    return janet_get(ds, key);
+  }
+}
+
+// We can only carry a map's hash forward if we can hash the new entry
+// without walking an entire collection.
+static bool path_hash_is_cheap(Janet value) {
+  if (janet_checkabstract(value, &set_type)) {
+    return CAST_SET_BOX(janet_unwrap_abstract(value))->hash.valid;
+  } else if (janet_checkabstract(value, &map_type)) {
+    return CAST_MAP_BOX(janet_unwrap_abstract(value))->hash.valid;
+  } else if (janet_checkabstract(value, &vec_type)) {
+    return CAST_VEC_BOX(janet_unwrap_abstract(value))->hash.valid;
+  } else {
+    return true;
+  }
+}
+
+static Janet path_put_map(Map *old_map, Janet key, Janet value) {
+  auto new_map = NEW_MAP();
+  *new_map = old_map->set(key, value);
+  if (CAST_MAP_BOX(old_map)->hash.valid && path_hash_is_cheap(value)) {
+    const Janet *old_value = old_map->find(key);
+    uint32_t removed = old_value == NULL ? 0 : map_entry_hash(key, *old_value);
+    map_derive_hash(old_map, new_map, map_entry_hash(key, value), removed);
+  }
+  return janet_wrap_abstract(new_map);
+}
+
+static Janet path_put_struct(JanetStruct old_struct, Janet key, Janet value) {
+  const JanetKV *kvs;
+  int32_t length, capacity;
+  janet_dictionary_view(janet_wrap_struct(old_struct), &kvs, &length, &capacity);
+  JanetKV *new_struct = janet_struct_begin(length + 1);
+  for (int32_t i = 0; i < capacity; i++) {
+    if (!janet_checktype(kvs[i].key, JANET_NIL) && !janet_equals(kvs[i].key, key)) {
+      janet_struct_put(new_struct, kvs[i].key, kvs[i].value);
+    }
+  }
+  janet_struct_put(new_struct, key, value);
+  return janet_wrap_struct(janet_struct_end(new_struct));
+}
+
+static Janet path_put_tuple(JanetTuple old_tuple, Janet key, Janet value) {
+  int32_t length = janet_tuple_length(old_tuple);
+  if (!janet_checkint(key) || janet_unwrap_integer(key) < 0 || janet_unwrap_integer(key) > length) {
+    janet_panicf("expected integer key in range [0, %d], got %v", length, key);
+  }
+  // Like vecs, a key equal to the length appends.
+  int32_t index = janet_unwrap_integer(key);
+  Janet *new_tuple = janet_tuple_begin(index == length ? length + 1 : length);
+  for (int32_t i = 0; i < length; i++) {
+    new_tuple[i] = old_tuple[i];
+  }
+  new_tuple[index] = value;
+  return janet_wrap_tuple(janet_tuple_end(new_tuple));
+}
+
+// Returns a data structure like `ds` but with `key` set to `value`. A missing
+// intermediate collection becomes a new jimmy map.
+static Janet path_put(Janet ds, Janet key, Janet value) {
+  switch (janet_type(ds)) {
+    case JANET_NIL: {
+      auto new_map = NEW_MAP();
+      *new_map = Map().set(key, value);
+      return janet_wrap_abstract(new_map);
+    }
+    case JANET_STRUCT:
+      return path_put_struct(janet_unwrap_struct(ds), key, value);
+    case JANET_TUPLE:
+      return path_put_tuple(janet_unwrap_tuple(ds), key, value);
+    case JANET_ABSTRACT: {
+      if (janet_checkabstract(ds, &map_type)) {
+        return path_put_map(CAST_MAP(janet_unwrap_abstract(ds)), key, value);
+      } else if (janet_checkabstract(ds, &vec_type)) {
+        auto old_vec = CAST_VEC(janet_unwrap_abstract(ds));
+        size_t size = old_vec->size();
+        if (!janet_checksize(key) || static_cast<size_t>(janet_unwrap_number(key)) > size) {
+          janet_panicf("expected integer key in range [0, %d], got %v", size, key);
+        }
+        size_t index = static_cast<size_t>(janet_unwrap_number(key));
+        auto new_vec = NEW_VEC();
+        *new_vec = index == size ? old_vec->push_back(value) : old_vec->set(index, value);
+        return janet_wrap_abstract(new_vec);
+      }
+    }
+    /* fallthrough */
+    default:
+      janet_put(ds, key, value);
+      return ds;
+  }
+}
+
+// `args` is only non-NULL for update-in, in which case `value` is the callable
+// to invoke with the old value and `args`.
+static Janet path_put_in(Janet ds, const Janet *path, int32_t path_length, Janet value, const Janet *args, int32_t argc) {
+  if (path_length == 0) {
+    if (args == NULL) {
+      return value;
+    }
+    return call_with_first(value, ds, args, argc);
+  }
+  Janet child = path_get(ds, path[0]);
+  Janet new_child = path_put_in(child, path + 1, path_length - 1, value, args, argc);
+  return path_put(ds, path[0], new_child);
+}
+
+static Janet cfun_path_get_in(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+  JanetView path = janet_getindexed(argv, 1);
+  Janet ds = argv[0];
+  for (int32_t i = 0; i < path.len; i++) {
+    ds = path_get(ds, path.items[i]);
+    if (janet_checktype(ds, JANET_NIL)) {
+      break;
+    }
+  }
+  return janet_checktype(ds, JANET_NIL) && argc == 3 ? argv[2] : ds;
+}
+
+static Janet cfun_path_put_in(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+  JanetView path = janet_getindexed(argv, 1);
+  return path_put_in(argv[0], path.items, path.len, argv[2], NULL, 0);
+}
+
+static Janet cfun_path_update_in(int32_t argc, Janet *argv) {
+  janet_arity(argc, 3, -1);
+  JanetView path = janet_getindexed(argv, 1);
+  return path_put_in(argv[0], path.items, path.len, argv[2], argv + 3, argc - 3);
+}
+
+static const JanetReg path_cfuns[] = {
+  {"map/get-in", cfun_path_get_in, "(map/get-in ds path &opt default)\n\n"
+    "Looks up a value by following each key in `path`, through any mix of jimmy maps, jimmy vecs and Janet data structures. "
+    "Returns `default` if any key along the way is missing."},
+  {"map/put-in", cfun_path_put_in, "(map/put-in ds path value)\n\n"
+    "Returns a new data structure with the value at `path` replaced. Only the collections along the path are copied, "
+    "and everything else is shared with the original. Missing intermediate collections are created as jimmy maps. "
+    "Janet tables and arrays along the path are mutated in place, like `put-in`."},
+  {"map/update-in", cfun_path_update_in, "(map/update-in ds path f & args)\n\n"
+    "Like `map/put-in`, but the new value is `(f old-value ;args)`. "
+    "`f` can be any callable value, not just a function."},
+  {"vec/get-in", cfun_path_get_in, "(vec/get-in ds path &opt default)\n\n"
+    "Looks up a value by following each key in `path`, through any mix of jimmy maps, jimmy vecs and Janet data structures. "
+    "Returns `default` if any key along the way is missing."},
+  {"vec/put-in", cfun_path_put_in, "(vec/put-in ds path value)\n\n"
+    "Returns a new data structure with the value at `path` replaced. Only the collections along the path are copied, "
+    "and everything else is shared with the original. Missing intermediate collections are created as jimmy maps. "
+    "Janet tables and arrays along the path are mutated in place, like `put-in`."},
+  {"vec/update-in", cfun_path_update_in, "(vec/update-in ds path f & args)\n\n"
+    "Like `vec/put-in`, but the new value is `(f old-value ;args)`. "
+    "`f` can be any callable value, not just a function."},
+  {NULL, NULL, NULL}
+};
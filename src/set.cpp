@@ -1,12 +1,27 @@
 #include <immer/set.hpp>
 #include <immer/set_transient.hpp>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
-#define CAST_SET(expr) static_cast<immer::set<Janet> *>((expr))
+typedef immer::set<Janet, std::hash<Janet>, std::equal_to<Janet>, MemoryPolicy> Set;
+typedef immer::set_transient<Janet, std::hash<Janet>, std::equal_to<Janet>, MemoryPolicy> TSet;
+
+// The abstract holds the set along with its cached hash. Everything that
+// doesn't care about the hash can treat it as a plain Set.
+struct SetBox : Set {
+  HashCache hash;
+};
+
+// Value-initializing a SetBox zeroes its hash cache.
+#define CAST_SET_BOX(expr) static_cast<SetBox *>((expr))
+#define CAST_SET(expr) static_cast<Set *>(CAST_SET_BOX(expr))
 #define CAST_SET_ITERATOR(expr) static_cast<SetIterator *>((expr))
-#define NEW_SET() new (janet_abstract(&set_type, sizeof(immer::set<Janet>))) immer::set<Janet>()
+#define NEW_SET() CAST_SET((mark_arm(), new (janet_abstract(&set_type, sizeof(SetBox))) SetBox()))
 
-#define CAST_TSET(expr) static_cast<immer::set_transient<Janet> *>((expr))
-#define NEW_TSET() new (janet_abstract(&tset_type, sizeof(immer::set_transient<Janet>))) immer::set_transient<Janet>()
+#define CAST_TSET(expr) static_cast<TSet *>((expr))
+#define NEW_TSET() new (janet_abstract(&tset_type, sizeof(TSet))) TSet()
 
 static int tset_gc(void *data, size_t len) {
   (void) len;
@@ -30,8 +45,21 @@ static const JanetAbstractType tset_type = {
   .call = NULL,
 };
 
+// Large inputs are inserted in trie order; see `bulk_load_order`.
+static void set_insert_all(TSet &transient, const Janet *items, int32_t count) {
+  if (static_cast<size_t>(count) < BULK_LOAD_MIN) {
+    for (int32_t i = 0; i < count; i++) {
+      transient.insert(items[i]);
+    }
+    return;
+  }
+  for (auto offset : bulk_load_order(items, count, 1)) {
+    transient.insert(items[offset]);
+  }
+}
+
 typedef struct {
-  immer::set<Janet>::iterator actual;
+  Set::iterator actual;
   Janet backing_set;
 } SetIterator;
 
@@ -99,17 +127,17 @@ static int set_iterator_get(void *data, Janet key, Janet *out) {
 
 static int set_gc(void *data, size_t len) {
   (void) len;
-  auto set = CAST_SET(data);
-  set->~set();
+  auto box = CAST_SET_BOX(data);
+  box->~SetBox();
   return 0;
 }
 
 static int set_gcmark(void *data, size_t len) {
   (void) len;
   auto set = CAST_SET(data);
-  for (auto el : *set) {
+  mark_champ(set->impl(), [](const Janet &el) {
     janet_mark(el);
-  }
+  });
   return 0;
 }
 
@@ -190,48 +218,381 @@ static Janet set_call(void *data, int32_t argc, Janet *argv) {
   return janet_wrap_boolean(set->count(argv[0]));
 }
 
+static thread_local MarshalHistory<Set> set_marshal_history;
+static thread_local MarshalHistory<Set> set_unmarshal_history;
+
 static void set_marshal(void *data, JanetMarshalContext *ctx) {
   janet_marshal_abstract(ctx, data);
+  janet_marshal_int(ctx, MARSHAL_FORMAT);
+  marshal_begin(ctx);
   auto set = CAST_SET(data);
-  janet_marshal_int(ctx, static_cast<int32_t>(set->size()));
-  for (auto el : *set) {
-    janet_marshal_janet(ctx, el);
+  auto &history = set_marshal_history.current(marshal_generation);
+
+  if (marshal_shareable(ctx) && marshal_every(*set, marshal_immediate)) {
+    marshal_share(ctx, *set);
+    history.push_back(set);
+    return;
   }
+
+  int32_t base = MARSHAL_NO_BASE;
+  std::vector<Janet> added, removed;
+  size_t limit = set->size() / 2;
+  for (size_t i = history.size(), tried = 0; i > 0 && tried < MARSHAL_BASE_CANDIDATES; i--) {
+    auto candidate = history[i - 1];
+    auto size_difference = candidate->size() > set->size() ? candidate->size() - set->size() : set->size() - candidate->size();
+    if (size_difference >= limit) {
+      continue;
+    }
+    tried++;
+    added.clear();
+    removed.clear();
+    bool small = structural_diff_within(limit, *candidate, *set,
+      [&](const Janet &el) { added.push_back(el); },
+      [&](const Janet &el) { removed.push_back(el); },
+      [](const Janet &, const Janet &) {});
+    if (small) {
+      base = static_cast<int32_t>(i - 1);
+      break;
+    }
+  }
+
+  janet_marshal_int(ctx, base);
+  if (base == MARSHAL_NO_BASE) {
+    janet_marshal_int(ctx, static_cast<int32_t>(set->size()));
+    for (auto el : *set) {
+      janet_marshal_janet(ctx, el);
+    }
+  } else {
+    janet_marshal_int(ctx, static_cast<int32_t>(removed.size()));
+    for (auto el : removed) {
+      janet_marshal_janet(ctx, el);
+    }
+    janet_marshal_int(ctx, static_cast<int32_t>(added.size()));
+    for (auto el : added) {
+      janet_marshal_janet(ctx, el);
+    }
+  }
+  history.push_back(set);
 }
 
-static void *set_unmarshal(JanetMarshalContext *ctx) {
-  auto set = CAST_SET(janet_unmarshal_abstract(ctx, sizeof(immer::set<Janet>)));
-  new (set) immer::set<Janet>();
-  auto transient = set->transient();
-  int32_t size = janet_unmarshal_int(ctx);
+static void set_unmarshal_elements(JanetMarshalContext *ctx, Set *set, int32_t size) {
+  JanetArray *elements = janet_array(0);
   for (int32_t i = 0; i < size; i++) {
-    transient.insert(janet_unmarshal_janet(ctx));
+    janet_array_push(elements, janet_unmarshal_janet(ctx));
   }
+  auto transient = set->transient();
+  set_insert_all(transient, elements->data, elements->count);
   *set = transient.persistent();
+}
+
+static void *set_unmarshal(JanetMarshalContext *ctx) {
+  auto set = CAST_SET(new (janet_unmarshal_abstract(ctx, sizeof(SetBox))) SetBox());
+  int32_t old_size = unmarshal_format(ctx);
+  if (old_size != MARSHAL_FORMAT) {
+    set_unmarshal_elements(ctx, set, old_size);
+    return set;
+  }
+  unmarshal_begin(ctx);
+  auto &history = set_unmarshal_history.current(unmarshal_generation);
+  int32_t base = unmarshal_base(ctx, history.size());
+  if (base == MARSHAL_SHARED) {
+    unmarshal_share(ctx, *set);
+  } else if (base == MARSHAL_NO_BASE) {
+    set_unmarshal_elements(ctx, set, janet_unmarshal_int(ctx));
+  } else {
+    JanetArray *removed = janet_array(0);
+    int32_t removed_count = janet_unmarshal_int(ctx);
+    for (int32_t i = 0; i < removed_count; i++) {
+      janet_array_push(removed, janet_unmarshal_janet(ctx));
+    }
+    JanetArray *added = janet_array(0);
+    int32_t added_count = janet_unmarshal_int(ctx);
+    for (int32_t i = 0; i < added_count; i++) {
+      janet_array_push(added, janet_unmarshal_janet(ctx));
+    }
+    auto transient = history[base]->transient();
+    for (int32_t i = 0; i < removed->count; i++) {
+      transient.erase(removed->data[i]);
+    }
+    for (int32_t i = 0; i < added->count; i++) {
+      transient.insert(added->data[i]);
+    }
+    *set = transient.persistent();
+  }
+  history.push_back(set);
   return set;
 }
 
+// Parallelism
+
+// Set algebra mostly comes down to finding the elements of one set that are,
+// or aren't, in another. Both tries branch on the same bits of each hash, so
+// we can skip every subtree that the two sets share by pointer, like
+// immer::diff does, and probe the other set for each element of the rest.
+// Every branch of the root covers its own slice of hashes, so for large sets
+// we walk the branches on several threads at once. This only reads the
+// tries, so it doesn't need atomic reference counts. Probing hashes elements,
+// though, and only the calling thread can call the hash functions of abstract
+// types from other libraries, so elements that might need one are left for
+// it to probe once the others are done. Only immer can build a trie, so the
+// matches come back to the calling thread, which applies them to a
+// transient.
+
+// 0 means one thread per core. This is shared by every thread, including the
+// ones that run async set algebra.
+static std::atomic<size_t> set_threads(0);
+
+// Below this many elements, starting threads costs more than it saves.
+static const size_t SET_PARALLEL_MIN = 1 << 17;
+
+static size_t set_thread_count() {
+  size_t threads = set_threads.load();
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  return threads == 0 ? 1 : threads;
+}
+
+static bool set_parallel(const Set &set) {
+  return set.size() >= SET_PARALLEL_MIN && set_thread_count() > 1;
+}
+
+typedef struct {
+  const Set *other;
+  // Whether we want the elements that are in `other`, or the ones that aren't.
+  bool present;
+  // Whether the first match is enough.
+  bool first_only;
+  std::atomic<bool> stop;
+} SetMatch;
+
+// What one thread found.
+typedef struct {
+  std::vector<Janet> found;
+  // Elements that only the calling thread can hash; see `hash_is_thread_safe`.
+  std::vector<Janet> deferred;
+} SetMatches;
+
+static void set_match_element(SetMatch &match, SetMatches &matches, const Janet &el) {
+  if (!hash_is_thread_safe(el)) {
+    matches.deferred.push_back(el);
+    return;
+  }
+  if (match.other->count(el) == match.present) {
+    matches.found.push_back(el);
+    if (match.first_only) {
+      match.stop = true;
+    }
+  }
+}
+
+template <typename T, typename Hash, typename Equal, typename MemoryPolicy,
+          immer::detail::hamts::bits_t B, typename Fn>
+static void set_node_for_each(
+  immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *node,
+  immer::detail::hamts::count_t depth,
+  Fn &&fn
+) {
+  if (depth < immer::detail::hamts::max_depth<B>) {
+    auto values = node->values();
+    auto value_count = immer::detail::hamts::popcount(node->datamap());
+    for (immer::detail::hamts::count_t i = 0; i < value_count; i++) {
+      fn(values[i]);
+    }
+    auto children = node->children();
+    auto child_count = immer::detail::hamts::popcount(node->nodemap());
+    for (immer::detail::hamts::count_t i = 0; i < child_count; i++) {
+      set_node_for_each(children[i], depth + 1, fn);
+    }
+  } else {
+    auto values = node->collisions();
+    auto value_count = node->collision_count();
+    for (immer::detail::hamts::count_t i = 0; i < value_count; i++) {
+      fn(values[i]);
+    }
+  }
+}
+
+// The child of `node` for hashes that continue with `position`, or NULL.
+template <typename Node>
+static Node *set_node_child(Node *node, immer::detail::hamts::count_t position) {
+  auto bit = decltype(node->nodemap())(1) << position;
+  if (node == NULL || !(node->nodemap() & bit)) {
+    return NULL;
+  }
+  return node->children()[immer::detail::hamts::popcount(node->nodemap() & (bit - 1))];
+}
+
+// Matches every element under `node`, which covers the same hashes as
+// `other`, at the same depth. `other` can be NULL.
+template <typename T, typename Hash, typename Equal, typename MemoryPolicy, immer::detail::hamts::bits_t B>
+static void set_match_node(
+  SetMatch &match,
+  SetMatches &matches,
+  immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *node,
+  immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *other,
+  immer::detail::hamts::count_t depth
+) {
+  if (match.stop) {
+    return;
+  }
+  if (node == other) {
+    if (match.present) {
+      set_node_for_each(node, depth, [&](const Janet &el) {
+        matches.found.push_back(el);
+      });
+      if (match.first_only) {
+        match.stop = true;
+      }
+    }
+    return;
+  }
+  if (other == NULL || depth >= immer::detail::hamts::max_depth<B>) {
+    set_node_for_each(node, depth, [&](const Janet &el) {
+      set_match_element(match, matches, el);
+    });
+    return;
+  }
+  auto values = node->values();
+  auto value_count = immer::detail::hamts::popcount(node->datamap());
+  for (immer::detail::hamts::count_t i = 0; i < value_count; i++) {
+    set_match_element(match, matches, values[i]);
+  }
+  for (immer::detail::hamts::count_t position = 0; position < (1u << B); position++) {
+    auto child = set_node_child(node, position);
+    if (child != NULL) {
+      set_match_node(match, matches, child, set_node_child(other, position), depth + 1);
+    }
+  }
+}
+
+// Matches the elements under one branch of the root of `set`.
+template <typename T, typename Hash, typename Equal, typename MemoryPolicy, immer::detail::hamts::bits_t B>
+static void set_match_branch(
+  SetMatch &match,
+  SetMatches &matches,
+  immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *root,
+  immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *other_root,
+  immer::detail::hamts::count_t position
+) {
+  auto bit = decltype(root->datamap())(1) << position;
+  if (root->datamap() & bit) {
+    set_match_element(match, matches, root->values()[immer::detail::hamts::popcount(root->datamap() & (bit - 1))]);
+  }
+  auto child = set_node_child(root, position);
+  if (child != NULL) {
+    set_match_node(match, matches, child, set_node_child(other_root, position), 1);
+  }
+}
+
+template <typename T, typename Hash, typename Equal, typename MemoryPolicy, immer::detail::hamts::bits_t B>
+static immer::detail::hamts::count_t set_branch_count(immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B> *) {
+  return immer::detail::hamts::count_t(1) << B;
+}
+
+// Returns the elements of `set` that are in `other`, if `present`, or the
+// ones that aren't. With `first_only`, returns at most one of them.
+static std::vector<Janet> set_parallel_match(const Set &set, const Set &other, bool present, bool first_only) {
+  SetMatch match;
+  match.other = &other;
+  match.present = present;
+  match.first_only = first_only;
+  match.stop = false;
+  auto root = set.impl().root;
+  auto other_root = other.impl().root;
+
+  auto branches = set_branch_count(root);
+  size_t threads = std::min(set_thread_count(), static_cast<size_t>(branches));
+  std::vector<SetMatches> matches(threads);
+  std::atomic<immer::detail::hamts::count_t> next_branch(0);
+  auto work = [&](size_t thread) {
+    for (auto branch = next_branch++; branch < branches && !match.stop; branch = next_branch++) {
+      set_match_branch(match, matches[thread], root, other_root, branch);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t thread = 1; thread < threads; thread++) {
+    workers.emplace_back(work, thread);
+  }
+  work(0);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  std::vector<Janet> result;
+  for (auto &thread_matches : matches) {
+    result.insert(result.end(), thread_matches.found.begin(), thread_matches.found.end());
+  }
+  for (auto &thread_matches : matches) {
+    for (auto el : thread_matches.deferred) {
+      if (first_only && !result.empty()) {
+        break;
+      }
+      if (other.count(el) == present) {
+        result.push_back(el);
+      }
+    }
+  }
+  if (first_only && result.size() > 1) {
+    result.resize(1);
+  }
+  return result;
+}
+
+static Janet cfun_set_parallelism(int32_t argc, Janet *argv) {
+  janet_arity(argc, 0, 1);
+  if (argc == 1) {
+    set_threads.store(janet_getsize(argv, 0));
+  }
+  return janet_wrap_number(static_cast<double>(set_thread_count()));
+}
+
 static int set_compare(void *data1, void *data2) {
   auto set1 = CAST_SET(data1);
   auto set2 = CAST_SET(data2);
-  if (*set1 == *set2) {
-    return 0;
+  if (!hashes_differ(CAST_SET_BOX(set1)->hash, CAST_SET_BOX(set2)->hash)) {
+    // Sets of the same size are equal if one is a subset of the other.
+    bool equal = set_parallel(*set1) && set1->size() == set2->size()
+      ? set_parallel_match(*set1, *set2, false, true).empty()
+      : *set1 == *set2;
+    if (equal) {
+      return 0;
+    }
   }
   return set1 > set2 ? 1 : -1;
 }
 
+static uint32_t set_element_hash(Janet el) {
+  return hash_scramble(static_cast<int32_t>(std::hash<Janet>()(el)));
+}
+
 static int32_t set_hash(void *data, size_t len) {
   (void) len;
-  auto set = CAST_SET(data);
-  // start with a random permutation of 16 1s and 16 0s
-  uint32_t hash = 0b01111110101101101101010000000001;
-  // Iteration is order is stable over hash values, regardless
-  // of how you construct the set.
-  // https://github.com/arximboldi/immer/discussions/249#discussioncomment-4620734
-  for (auto el : *set) {
-    hash = hash_mix(hash, static_cast<int32_t>(std::hash<Janet>()(el)));
+  auto box = CAST_SET_BOX(data);
+  if (!box->hash.valid) {
+    // start with a random permutation of 16 1s and 16 0s
+    uint32_t hash = 0b01111110101101101101010000000001;
+    for (auto el : *box) {
+      hash += set_element_hash(el);
+    }
+    box->hash.value = hash;
+    box->hash.valid = true;
   }
-  return hash;
+  return static_cast<int32_t>(box->hash.value);
+}
+
+// When the hash of the original set is already known, we can derive the hash
+// of an edited set from the elements that were actually added or removed.
+static void set_derive_hash_from(HashCache old_hash, Set *new_set, uint32_t added, uint32_t removed) {
+  if (old_hash.valid) {
+    auto new_box = CAST_SET_BOX(new_set);
+    new_box->hash.value = old_hash.value + added - removed;
+    new_box->hash.valid = true;
+  }
+}
+
+static void set_derive_hash(Set *old_set, Set *new_set, uint32_t added, uint32_t removed) {
+  set_derive_hash_from(CAST_SET_BOX(old_set)->hash, new_set, added, removed);
 }
 
 static const JanetAbstractType set_type = {
@@ -252,27 +613,50 @@ static const JanetAbstractType set_type = {
 static Janet cfun_set_new(int32_t argc, Janet *argv) {
   auto set = NEW_SET();
   auto transient = set->transient();
-  for (int32_t i = 0; i < argc; i++) {
-    transient.insert(argv[i]);
-  }
+  set_insert_all(transient, argv, argc);
   *set = transient.persistent();
   return janet_wrap_abstract(set);
 }
 
+// Defined in vec.cpp. Returns false if `source` is not a vec.
+static bool set_insert_vec(Janet source, TSet *transient);
+
 static Janet cfun_set_of(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
   Janet iterable = argv[0];
+  // Sets are immutable, so a set can stand in for a copy of itself.
+  if (janet_checkabstract(iterable, &set_type)) {
+    return iterable;
+  }
   auto set = NEW_SET();
   auto transient = NEW_TSET();
   *transient = set->transient();
 
-  auto key = janet_wrap_nil();
-  while (true) {
-    key = janet_next(iterable, key);
-    if (janet_checktype(key, JANET_NIL)) {
-      break;
+  // Walk the common collections directly, instead of paying for a call to
+  // `next` and a lookup for every element.
+  const Janet *items;
+  const JanetKV *kvs;
+  int32_t length, capacity;
+  if (janet_indexed_view(iterable, &items, &length)) {
+    set_insert_all(*transient, items, length);
+  } else if (janet_dictionary_view(iterable, &kvs, &length, &capacity)) {
+    std::vector<Janet> values;
+    values.reserve(length);
+    for (int32_t i = 0; i < capacity; i++) {
+      if (!janet_checktype(kvs[i].key, JANET_NIL)) {
+        values.push_back(kvs[i].value);
+      }
+    }
+    set_insert_all(*transient, values.data(), static_cast<int32_t>(values.size()));
+  } else if (!set_insert_vec(iterable, transient)) {
+    auto key = janet_wrap_nil();
+    while (true) {
+      key = janet_next(iterable, key);
+      if (janet_checktype(key, JANET_NIL)) {
+        break;
+      }
+      transient->insert(janet_in(iterable, key));
     }
-    transient->insert(janet_in(iterable, key));
   }
 
   *set = transient->persistent();
@@ -304,16 +688,26 @@ static Janet cfun_set_add(int32_t argc, Janet *argv) {
   auto old_set = CAST_SET(janet_getabstract(argv, 0, &set_type));
   auto new_set = NEW_SET();
 
+  bool track_hash = CAST_SET_BOX(old_set)->hash.valid;
+  uint32_t added = 0;
   int32_t new_elements = argc - 1;
   if (new_elements == 1) {
     *new_set = old_set->insert(argv[1]);
+    if (track_hash && new_set->size() != old_set->size()) {
+      added += set_element_hash(argv[1]);
+    }
   } else {
     auto transient = old_set->transient();
     for (int32_t i = 1; i < argc; i++) {
+      auto size = transient.size();
       transient.insert(argv[i]);
+      if (track_hash && transient.size() != size) {
+        added += set_element_hash(argv[i]);
+      }
     }
     *new_set = transient.persistent();
   }
+  set_derive_hash(old_set, new_set, added, 0);
   return janet_wrap_abstract(new_set);
 }
 
@@ -322,76 +716,251 @@ static Janet cfun_set_remove(int32_t argc, Janet *argv) {
   auto old_set = CAST_SET(janet_getabstract(argv, 0, &set_type));
   auto new_set = NEW_SET();
 
+  bool track_hash = CAST_SET_BOX(old_set)->hash.valid;
+  uint32_t removed = 0;
   int32_t erased_elements = argc - 1;
   if (erased_elements == 1) {
     *new_set = old_set->erase(argv[1]);
+    if (track_hash && new_set->size() != old_set->size()) {
+      removed += set_element_hash(argv[1]);
+    }
   } else {
     auto transient = old_set->transient();
     for (int32_t i = 1; i < argc; i++) {
+      auto size = transient.size();
       transient.erase(argv[i]);
+      if (track_hash && transient.size() != size) {
+        removed += set_element_hash(argv[i]);
+      }
     }
     *new_set = transient.persistent();
   }
+  set_derive_hash(old_set, new_set, 0, removed);
   return janet_wrap_abstract(new_set);
 }
 
-static Janet cfun_set_union(int32_t argc, Janet *argv) {
-  auto new_set = NEW_SET();
-  auto transient = NEW_TSET();
-  *transient = new_set->transient();
-  for (int32_t i = 0; i < argc; i++) {
-    auto old_set = CAST_SET(janet_getabstract(argv, i, &set_type));
-    for (auto el : *old_set) {
-      transient->insert(el);
+// Returns the sets in argv[start..argc), from smallest to largest. This checks
+// the type of every argument before it allocates anything, so the caller can
+// keep C++ values on the stack afterwards without worrying about a panic.
+static std::vector<Set *> sets_by_size(int32_t argc, Janet *argv, int32_t start) {
+  for (int32_t i = start; i < argc; i++) {
+    janet_getabstract(argv, i, &set_type);
+  }
+  std::vector<Set *> sets;
+  sets.reserve(argc - start);
+  for (int32_t i = start; i < argc; i++) {
+    sets.push_back(CAST_SET(janet_unwrap_abstract(argv[i])));
+  }
+  std::stable_sort(sets.begin(), sets.end(), [](Set *a, Set *b) {
+    return a->size() < b->size();
+  });
+  return sets;
+}
+
+static void ignore_value(const Janet &) {}
+static void ignore_change(const Janet &, const Janet &) {}
+
+// Starts from the largest set, so the result shares structure with it. Sets of
+// similar size are probably versions of the largest set, so we diff them
+// structurally and only insert the elements that the largest set is missing.
+// Much smaller sets are cheaper to iterate.
+//
+// `sets` runs from smallest to largest, and can't be empty. If `track_hash`,
+// adds the hashes of the elements that the largest set was missing to
+// `*added`.
+static Set set_union_of(std::vector<Set *> sets, bool track_hash, uint32_t *added) {
+  auto largest = sets.back();
+  sets.pop_back();
+
+  auto transient = largest->transient();
+  auto insert = [&](const Janet &el) {
+    auto size = transient.size();
+    transient.insert(el);
+    if (track_hash && transient.size() != size) {
+      *added += set_element_hash(el);
+    }
+  };
+  for (auto set : sets) {
+    if (set_parallel(*set)) {
+      for (auto el : set_parallel_match(*set, *largest, false, false)) {
+        insert(el);
+      }
+    } else if (similar_size(*largest, *set)) {
+      structural_diff(*largest, *set, insert, ignore_value, ignore_change);
+    } else {
+      for (auto el : *set) {
+        insert(el);
+      }
     }
   }
-  *new_set = transient->persistent();
-  return janet_wrap_abstract(new_set);
+  return transient.persistent();
 }
 
-static immer::set<Janet> *intersect2(immer::set<Janet> *a, immer::set<Janet> *b) {
+static Janet cfun_set_union(int32_t argc, Janet *argv) {
+  if (argc == 0) {
+    return janet_wrap_abstract(NEW_SET());
+  }
+  auto sets = sets_by_size(argc, argv, 0);
+  auto largest = sets.back();
+  uint32_t added = 0;
   auto new_set = NEW_SET();
-  auto transient = new_set->transient();
-  for (auto el : *a) {
-    if (b->count(el)) {
-      transient.insert(el);
+  *new_set = set_union_of(sets, CAST_SET_BOX(largest)->hash.valid, &added);
+  set_derive_hash(largest, new_set, added, 0);
+  return janet_wrap_abstract(new_set);
+}
+
+// Erases elements from a transient copy of the smallest set, so we never build
+// intermediate sets. Sets of similar size are diffed structurally against the
+// smallest set; the elements of the smallest set are probed against all of the
+// much larger sets in a single pass.
+//
+// `sets` runs from smallest to largest, and can't be empty. If `track_hash`,
+// adds the hashes of the elements erased from the smallest set to `*removed`.
+static Set set_intersection_of(const std::vector<Set *> &sets, bool track_hash, uint32_t *removed) {
+  auto smallest = sets.front();
+  auto first_large = std::find_if(sets.begin() + 1, sets.end(), [=](Set *set) {
+    return !similar_size(*smallest, *set);
+  });
+
+  auto transient = smallest->transient();
+  auto erase = [&](const Janet &el) {
+    auto size = transient.size();
+    transient.erase(el);
+    if (track_hash && transient.size() != size) {
+      *removed += set_element_hash(el);
+    }
+  };
+  if (set_parallel(*smallest)) {
+    for (auto it = sets.begin() + 1; it != sets.end(); it++) {
+      for (auto el : set_parallel_match(*smallest, **it, false, false)) {
+        erase(el);
+      }
+    }
+    return transient.persistent();
+  }
+  for (auto it = sets.begin() + 1; it != first_large; it++) {
+    structural_diff(*smallest, **it, ignore_value, erase, ignore_change);
+  }
+  if (first_large != sets.end()) {
+    for (auto el : *smallest) {
+      for (auto it = first_large; it != sets.end(); it++) {
+        if (!(*it)->count(el)) {
+          erase(el);
+          break;
+        }
+      }
     }
   }
-  *new_set = transient.persistent();
-  return new_set;
+  return transient.persistent();
 }
 
-// We could specialize this to count elements in a temporary map when argc > 2
-// but, you know, this library is not making any guarantees about time complexity.
 static Janet cfun_set_intersection(int32_t argc, Janet *argv) {
   if (argc == 0) {
     return janet_wrap_abstract(NEW_SET());
-  } else {
-    auto first_set = CAST_SET(janet_getabstract(argv, 0, &set_type));
-    for (int32_t i = 1; i < argc; i++) {
-      first_set = intersect2(first_set, CAST_SET(janet_getabstract(argv, i, &set_type)));
+  }
+  auto sets = sets_by_size(argc, argv, 0);
+  auto smallest = sets.front();
+  uint32_t removed = 0;
+  auto new_set = NEW_SET();
+  *new_set = set_intersection_of(sets, CAST_SET_BOX(smallest)->hash.valid, &removed);
+  set_derive_hash(smallest, new_set, 0, removed);
+  return janet_wrap_abstract(new_set);
+}
+
+// A subtrahend of similar size is probably another version of the first set,
+// so we diff the two structurally, which hands us exactly the elements that
+// survive. After that, subtrahends smaller than what's left are iterated,
+// erasing each of their elements, and subtrahends at least as large are
+// handled together by a single pass that probes each of them.
+//
+// `subtrahends` runs from smallest to largest. If `*track_hash`, adds the
+// hashes of the elements erased from `first_set` to `*removed`, or clears
+// `*track_hash` if the result can't be derived from `first_set`.
+static Set set_difference_of(const Set &first_set, std::vector<Set *> subtrahends, bool *track_hash, uint32_t *removed) {
+  if (set_parallel(first_set)) {
+    // Subtrahends of similar size or larger are matched against the first set,
+    // which keeps its structure, so we can still derive its hash.
+    auto transient = first_set.transient();
+    auto erase = [&](const Janet &el) {
+      auto size = transient.size();
+      transient.erase(el);
+      if (*track_hash && transient.size() != size) {
+        *removed += set_element_hash(el);
+      }
+    };
+    for (auto subtrahend : subtrahends) {
+      if (subtrahend->size() < first_set.size() && !similar_size(first_set, *subtrahend)) {
+        for (auto el : *subtrahend) {
+          erase(el);
+        }
+      } else {
+        for (auto el : set_parallel_match(first_set, *subtrahend, true, false)) {
+          erase(el);
+        }
+      }
+    }
+    return transient.persistent();
+  }
+
+  Set minuend = first_set;
+  for (auto it = subtrahends.begin(); it != subtrahends.end();) {
+    if (similar_size(minuend, **it)) {
+      auto survivors = Set().transient();
+      structural_diff(minuend, **it, ignore_value, [&](const Janet &el) {
+        survivors.insert(el);
+      }, ignore_change);
+      minuend = survivors.persistent();
+      *track_hash = false;
+      it = subtrahends.erase(it);
+    } else {
+      it++;
+    }
+  }
+  auto first_large = std::find_if(subtrahends.begin(), subtrahends.end(), [&](Set *set) {
+    return set->size() >= minuend.size();
+  });
+
+  auto transient = minuend.transient();
+  auto erase = [&](const Janet &el) {
+    auto size = transient.size();
+    transient.erase(el);
+    if (*track_hash && transient.size() != size) {
+      *removed += set_element_hash(el);
+    }
+  };
+  for (auto it = subtrahends.begin(); it != first_large; it++) {
+    for (auto el : **it) {
+      erase(el);
+    }
+  }
+  if (first_large != subtrahends.end()) {
+    for (auto el : minuend) {
+      for (auto it = first_large; it != subtrahends.end(); it++) {
+        if ((*it)->count(el)) {
+          erase(el);
+          break;
+        }
+      }
     }
-    return janet_wrap_abstract(first_set);
   }
+  return transient.persistent();
 }
 
 static Janet cfun_set_difference(int32_t argc, Janet *argv) {
   janet_arity(argc, 1, -1);
   auto first_set = CAST_SET(janet_getabstract(argv, 0, &set_type));
-  auto transient = NEW_TSET();
-  *transient = first_set->transient();
-  for (int32_t i = 1; i < argc; i++) {
-    auto other_set = CAST_SET(janet_getabstract(argv, i, &set_type));
-    for (auto el : *other_set) {
-      transient->erase(el);
-    }
-  }
+  auto subtrahends = sets_by_size(argc, argv, 1);
+  bool track_hash = CAST_SET_BOX(first_set)->hash.valid;
+  uint32_t removed = 0;
   auto new_set = NEW_SET();
-  *new_set = transient->persistent();
+  *new_set = set_difference_of(*first_set, subtrahends, &track_hash, &removed);
+  if (track_hash) {
+    set_derive_hash(first_set, new_set, 0, removed);
+  }
   return janet_wrap_abstract(new_set);
 }
 
-static bool subset_helper(immer::set<Janet> *a, immer::set<Janet> *b, bool strict) {
+static bool subset_helper(Set *a, Set *b, bool strict) {
   auto a_size = a->size();
   auto b_size = b->size();
   if (a_size > b_size) {
@@ -400,6 +969,16 @@ static bool subset_helper(immer::set<Janet> *a, immer::set<Janet> *b, bool stric
   if (a_size == b_size && strict) {
     return false;
   }
+  if (set_parallel(*a)) {
+    return set_parallel_match(*a, *b, false, true).empty();
+  }
+  if (similar_size(*a, *b)) {
+    bool missing = false;
+    structural_diff(*a, *b, ignore_value, [&](const Janet &) {
+      missing = true;
+    }, ignore_change);
+    return !missing;
+  }
   for (auto el : *a) {
     if (!b->count(el)) {
       return false;
@@ -444,24 +1023,60 @@ static Janet cfun_set_strict_superset(int32_t argc, Janet *argv) {
   ));
 }
 
+// Costs time proportional to the number of elements that differ, as long as
+// the two sets are versions of each other.
+static Janet cfun_set_diff(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto old_set = CAST_SET(janet_getabstract(argv, 0, &set_type));
+  auto new_set = CAST_SET(janet_getabstract(argv, 1, &set_type));
+  auto added = NEW_SET();
+  auto removed = NEW_SET();
+  auto added_transient = added->transient();
+  auto removed_transient = removed->transient();
+  structural_diff(*old_set, *new_set, [&](const Janet &el) {
+    added_transient.insert(el);
+  }, [&](const Janet &el) {
+    removed_transient.insert(el);
+  }, ignore_change);
+  *added = added_transient.persistent();
+  *removed = removed_transient.persistent();
+
+  JanetKV *result = janet_struct_begin(2);
+  janet_struct_put(result, janet_ckeywordv("added"), janet_wrap_abstract(added));
+  janet_struct_put(result, janet_ckeywordv("removed"), janet_wrap_abstract(removed));
+  return janet_wrap_struct(janet_struct_end(result));
+}
+
+// Defined in intset.cpp. Returns NULL if `source` is not an intset.
+static JanetArray *set_intset_to_array(Janet source);
+
 static Janet cfun_set_to_tuple(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
+  JanetArray *array = set_intset_to_array(argv[0]);
+  if (array != NULL) {
+    return janet_wrap_tuple(janet_tuple_n(array->data, array->count));
+  }
   auto set = CAST_SET(janet_getabstract(argv, 0, &set_type));
   Janet *result = janet_tuple_begin(set->size());
-  size_t i = 0;
-  for (auto el : *set) {
-    result[i++] = el;
-  }
+  Janet *out = result;
+  immer::for_each_chunk(*set, [&](const Janet *first, const Janet *last) {
+    out = std::copy(first, last, out);
+  });
   return janet_wrap_tuple(janet_tuple_end(result));
 }
 
 static Janet cfun_set_to_array(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
+  JanetArray *array = set_intset_to_array(argv[0]);
+  if (array != NULL) {
+    return janet_wrap_array(array);
+  }
   auto set = CAST_SET(janet_getabstract(argv, 0, &set_type));
   JanetArray *result = janet_array(set->size());
-  for (auto el : *set) {
-    janet_array_push(result, el);
-  }
+  immer::for_each_chunk(*set, [&](const Janet *first, const Janet *last) {
+    std::copy(first, last, result->data + result->count);
+    result->count += static_cast<int32_t>(last - first);
+  });
   return janet_wrap_array(result);
 }
 
@@ -535,6 +1150,41 @@ static Janet cfun_set_filter_map(int32_t argc, Janet *argv) {
   return janet_wrap_abstract(new_set);
 }
 
+// Defined in view.cpp, so that views can be traversed like the collections
+// they're views of.
+static bool view_each(Janet value, const JanetAbstractType *source_type, Janet f, bool chunked);
+
+// Walks the nodes of the set directly, without allocating an iterator.
+static Janet cfun_set_each(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (view_each(argv[0], &set_type, argv[1], false)) {
+    return janet_wrap_nil();
+  }
+  auto set = CAST_SET(janet_getabstract(argv, 0, &set_type));
+  auto f = argv[1];
+  immer::for_each_chunk(*set, [&](const Janet *first, const Janet *last) {
+    for (; first != last; first++) {
+      Janet el = *first;
+      call_callable(f, 1, &el);
+    }
+  });
+  return janet_wrap_nil();
+}
+
+static Janet cfun_set_each_chunk(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (view_each(argv[0], &set_type, argv[1], true)) {
+    return janet_wrap_nil();
+  }
+  auto set = CAST_SET(janet_getabstract(argv, 0, &set_type));
+  auto f = argv[1];
+  immer::for_each_chunk(*set, [&](const Janet *first, const Janet *last) {
+    Janet chunk = janet_wrap_tuple(janet_tuple_n(first, static_cast<int32_t>(last - first)));
+    call_callable(f, 1, &chunk);
+  });
+  return janet_wrap_nil();
+}
+
 static Janet cfun_set_reduce(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 3);
   auto set = CAST_SET(janet_getabstract(argv, 0, &set_type));
@@ -575,9 +1225,13 @@ static const JanetReg set_cfuns[] = {
   {"set/union", cfun_set_union, "(set/union & sets)\n\n"
     "Returns a set that is the union of all of its arguments."},
   {"set/intersection", cfun_set_intersection, "(set/intersection & sets)\n\n"
-    "Returns a set that is the intersection of all of its arguments. Naively folds when given more than two arguments."},
+    "Returns a set that is the intersection of all of its arguments."},
   {"set/difference", cfun_set_difference, "(set/difference set & sets)\n\n"
     "Returns a set that is the first set minus all of the latter sets."},
+  {"set/parallelism", cfun_set_parallelism, "(set/parallelism &opt threads)\n\n"
+    "Returns the number of threads that set algebra, subset checks and equality use for sets with at least 131072 elements. "
+    "With an argument, sets it first, for every thread. 0 means one thread per core, which is the default. "
+    "Sets that contain abstract types from other libraries with their own hash functions are always handled on one thread."},
   {"set/subset?", cfun_set_subset, "(set/subset? a b)\n\n"
     "Returns true if `a` is a subset of `b`."},
   {"set/superset?", cfun_set_superset, "(set/superset? a b)\n\n"
@@ -586,10 +1240,16 @@ static const JanetReg set_cfuns[] = {
     "Returns true if `a` is a strict subset of `b`."},
   {"set/strict-superset?", cfun_set_strict_superset, "(set/strict-superset? a b)\n\n"
     "Returns true if `a` is a strict superset of `b`."},
+  {"set/diff", cfun_set_diff, "(set/diff old new)\n\n"
+    "Returns a struct with two sets: `:added`, the elements in `new` but not `old`, and `:removed`, "
+    "the elements in `old` but not `new`. Subtrees that the two sets share are skipped, so "
+    "diffing two versions of the same set is proportional to the number of changes, not the size of the sets."},
   {"set/to-tuple", cfun_set_to_tuple, "(set/to-tuple set)\n\n"
-    "Returns a tuple of all of the elements in the set, in no particular order."},
+    "Returns a tuple of all of the elements in the set, in no particular order. "
+    "`set` can also be an intset, whose elements come out in ascending order."},
   {"set/to-array", cfun_set_to_array, "(set/to-array set)\n\n"
-    "Returns an array of all of the elements in the set, in no particular order."},
+    "Returns an array of all of the elements in the set, in no particular order. "
+    "`set` can also be an intset, whose elements come out in ascending order."},
   {"set/map", cfun_set_map, "(set/map set f)\n\n"
     "Returns a new set derived from the given transformation function. "
     "`f` can be any callable value, not just a function.\n\n"
@@ -602,6 +1262,14 @@ static const JanetReg set_cfuns[] = {
     "Returns a set containing only the elements for which the predicate returns a truthy value. "
     "`pred` can be any callable value, not just a function.\n\n"
     "Note that the arguments are in the opposite order of Janet's `filter` function."},
+  {"set/each", cfun_set_each, "(set/each set f)\n\n"
+    "Calls `f` on every element of the set or filter view, in arbitrary order, and returns `nil`. "
+    "This is faster than iterating over the set with `each`, because it doesn't allocate an iterator. "
+    "`f` can be any callable value, not just a function."},
+  {"set/each-chunk", cfun_set_each_chunk, "(set/each-chunk set f)\n\n"
+    "Calls `f` with a tuple of the elements stored in each node of the set, in arbitrary order, and returns `nil`. "
+    "For a filter view, each tuple holds the elements of one node that pass the filter. "
+    "`f` can be any callable value, not just a function."},
   {"set/reduce", cfun_set_reduce, "(set/reduce set init f)\n\n"
     "Returns a reduction of the elements in the set, which will be traversed in arbitrary order. "
     "`f` can be any callable value, not just a function.\n\n"
@@ -0,0 +1,720 @@
+#include <vector>
+
+// Persistent sorted sets and maps, ordered by `janet_compare`.
+//
+// Both are treaps: binary search trees that are also heaps on a priority
+// derived from each key's hash. The priority of a key never changes, so a
+// given set of keys always produces the same tree, no matter what order they
+// were added in, and the tree is balanced with high probability. Every node
+// records the size of its subtree, which gives us rank and select in
+// O(log n).
+//
+// Updates copy the path from the root to the change and share everything
+// else. Split and join only ever walk one path, so carving a range out of a
+// collection, or putting two collections back together, is O(log n).
+//
+// Sorted sets are sorted maps whose values are their keys.
+
+typedef struct SortedNode : MemoryPolicy::refcount {
+  uint32_t priority;
+  size_t size;
+  Janet key;
+  Janet value;
+  struct SortedNode *left;
+  struct SortedNode *right;
+} SortedNode;
+
+typedef struct {
+  SortedNode *root;
+  bool is_map;
+  HashCache hash;
+} SortedBox;
+
+#define CAST_SORTED(expr) static_cast<SortedBox *>((expr))
+
+// Nodes
+
+static size_t sorted_size(const SortedNode *node) {
+  return node == NULL ? 0 : node->size;
+}
+
+static SortedNode *sorted_retain(SortedNode *node) {
+  if (node != NULL) {
+    node->inc();
+  }
+  return node;
+}
+
+static void sorted_release(SortedNode *node) {
+  while (node != NULL && node->dec()) {
+    SortedNode *right = node->right;
+    sorted_release(node->left);
+    node->~SortedNode();
+    JanetHeap::deallocate(sizeof(SortedNode), node);
+    node = right;
+  }
+}
+
+// Takes ownership of `left` and `right`.
+static SortedNode *sorted_node(Janet key, Janet value, uint32_t priority, SortedNode *left, SortedNode *right) {
+  auto node = new (JanetHeap::allocate(sizeof(SortedNode))) SortedNode();
+  node->priority = priority;
+  node->size = sorted_size(left) + 1 + sorted_size(right);
+  node->key = key;
+  node->value = value;
+  node->left = left;
+  node->right = right;
+  return node;
+}
+
+static SortedNode *sorted_copy(const SortedNode *node, SortedNode *left, SortedNode *right) {
+  return sorted_node(node->key, node->value, node->priority, left, right);
+}
+
+static uint32_t sorted_priority(Janet key) {
+  return hash_scramble(janet_hash(key));
+}
+
+// Ties are broken by key, so that the shape of the tree only depends on its
+// keys.
+static bool sorted_outranks(uint32_t priority, Janet key, const SortedNode *node) {
+  return priority > node->priority || (priority == node->priority && janet_compare(key, node->key) < 0);
+}
+
+// The functions below borrow the nodes that they're given and return new
+// references.
+
+static const SortedNode *sorted_find(const SortedNode *node, Janet key) {
+  while (node != NULL) {
+    int order = janet_compare(key, node->key);
+    if (order == 0) {
+      return node;
+    }
+    node = order < 0 ? node->left : node->right;
+  }
+  return NULL;
+}
+
+// Splits a tree into the keys less than `key` and the rest.
+static void sorted_split(SortedNode *node, Janet key, SortedNode **left, SortedNode **right) {
+  if (node == NULL) {
+    *left = NULL;
+    *right = NULL;
+    return;
+  }
+  if (janet_compare(node->key, key) < 0) {
+    SortedNode *middle;
+    sorted_split(node->right, key, &middle, right);
+    *left = sorted_copy(node, sorted_retain(node->left), middle);
+  } else {
+    SortedNode *middle;
+    sorted_split(node->left, key, left, &middle);
+    *right = sorted_copy(node, middle, sorted_retain(node->right));
+  }
+}
+
+// Splits a tree into its first `rank` keys and the rest.
+static void sorted_split_at(SortedNode *node, size_t rank, SortedNode **left, SortedNode **right) {
+  if (node == NULL) {
+    *left = NULL;
+    *right = NULL;
+    return;
+  }
+  size_t left_size = sorted_size(node->left);
+  if (rank <= left_size) {
+    SortedNode *middle;
+    sorted_split_at(node->left, rank, left, &middle);
+    *right = sorted_copy(node, middle, sorted_retain(node->right));
+  } else {
+    SortedNode *middle;
+    sorted_split_at(node->right, rank - left_size - 1, &middle, right);
+    *left = sorted_copy(node, sorted_retain(node->left), middle);
+  }
+}
+
+// Every key in `left` must be less than every key in `right`.
+static SortedNode *sorted_join(SortedNode *left, SortedNode *right) {
+  if (left == NULL) {
+    return sorted_retain(right);
+  } else if (right == NULL) {
+    return sorted_retain(left);
+  } else if (sorted_outranks(left->priority, left->key, right)) {
+    return sorted_copy(left, sorted_retain(left->left), sorted_join(left->right, right));
+  } else {
+    return sorted_copy(right, sorted_join(left, right->left), sorted_retain(right->right));
+  }
+}
+
+static SortedNode *sorted_insert(SortedNode *node, Janet key, Janet value, uint32_t priority) {
+  if (node == NULL || sorted_outranks(priority, key, node)) {
+    // `key` can't be anywhere below `node`: its priority would put it here.
+    SortedNode *left, *right;
+    sorted_split(node, key, &left, &right);
+    return sorted_node(key, value, priority, left, right);
+  }
+  int order = janet_compare(key, node->key);
+  if (order == 0) {
+    return sorted_node(key, value, priority, sorted_retain(node->left), sorted_retain(node->right));
+  } else if (order < 0) {
+    return sorted_copy(node, sorted_insert(node->left, key, value, priority), sorted_retain(node->right));
+  } else {
+    return sorted_copy(node, sorted_retain(node->left), sorted_insert(node->right, key, value, priority));
+  }
+}
+
+static SortedNode *sorted_remove(SortedNode *node, Janet key) {
+  int order = janet_compare(key, node->key);
+  if (order == 0) {
+    return sorted_join(node->left, node->right);
+  } else if (order < 0) {
+    return sorted_copy(node, sorted_remove(node->left, key), sorted_retain(node->right));
+  } else {
+    return sorted_copy(node, sorted_retain(node->left), sorted_remove(node->right, key));
+  }
+}
+
+static size_t sorted_rank(const SortedNode *node, Janet key) {
+  size_t rank = 0;
+  while (node != NULL) {
+    if (janet_compare(node->key, key) < 0) {
+      rank += sorted_size(node->left) + 1;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return rank;
+}
+
+static const SortedNode *sorted_select(const SortedNode *node, size_t rank) {
+  while (node != NULL) {
+    size_t left_size = sorted_size(node->left);
+    if (rank == left_size) {
+      return node;
+    } else if (rank < left_size) {
+      node = node->left;
+    } else {
+      rank -= left_size + 1;
+      node = node->right;
+    }
+  }
+  return NULL;
+}
+
+// The greatest key <= `key` (or < `key`, if not `inclusive`).
+static const SortedNode *sorted_floor(const SortedNode *node, Janet key, bool inclusive) {
+  const SortedNode *result = NULL;
+  while (node != NULL) {
+    int order = janet_compare(node->key, key);
+    if (order < 0 || (order == 0 && inclusive)) {
+      result = node;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return result;
+}
+
+// The least key >= `key` (or > `key`, if not `inclusive`).
+static const SortedNode *sorted_ceiling(const SortedNode *node, Janet key, bool inclusive) {
+  const SortedNode *result = NULL;
+  while (node != NULL) {
+    int order = janet_compare(node->key, key);
+    if (order > 0 || (order == 0 && inclusive)) {
+      result = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return result;
+}
+
+template <typename Fn>
+static void sorted_for_each(const SortedNode *node, Fn &&fn) {
+  while (node != NULL) {
+    sorted_for_each(node->left, fn);
+    fn(node);
+    node = node->right;
+  }
+}
+
+// The abstract types
+
+static int sorted_gc(void *data, size_t len) {
+  (void) len;
+  sorted_release(CAST_SORTED(data)->root);
+  return 0;
+}
+
+static void sorted_mark_node(const SortedNode *node) {
+  while (node != NULL && mark_visit(node)) {
+    janet_mark(node->key);
+    janet_mark(node->value);
+    sorted_mark_node(node->left);
+    node = node->right;
+  }
+}
+
+static int sorted_gcmark(void *data, size_t len) {
+  (void) len;
+  sorted_mark_node(CAST_SORTED(data)->root);
+  return 0;
+}
+
+static Janet cfun_sorted_length(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return janet_wrap_number(static_cast<double>(sorted_size(CAST_SORTED(janet_unwrap_abstract(argv[0]))->root)));
+}
+
+static const JanetMethod sorted_methods[] = {
+  {"length", cfun_sorted_length},
+  {NULL, NULL}
+};
+
+// Iterating over a sorted collection visits its keys in order, using the keys
+// themselves as iteration keys, so `get` works the same way for iteration as
+// it does for lookups.
+static int sorted_get(void *data, Janet key, Janet *out) {
+  const SortedNode *node = sorted_find(CAST_SORTED(data)->root, key);
+  if (node != NULL) {
+    *out = node->value;
+    return 1;
+  } else if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), sorted_methods, out);
+  } else {
+    return 0;
+  }
+}
+
+static Janet sorted_next(void *data, Janet key) {
+  auto root = CAST_SORTED(data)->root;
+  const SortedNode *node = janet_checktype(key, JANET_NIL)
+    ? sorted_select(root, 0)
+    : sorted_ceiling(root, key, false);
+  return node == NULL ? janet_wrap_nil() : node->key;
+}
+
+static Janet sorted_call(void *data, int32_t argc, Janet *argv) {
+  if (!CAST_SORTED(data)->is_map) {
+    janet_fixarity(argc, 1);
+    return janet_wrap_boolean(sorted_find(CAST_SORTED(data)->root, argv[0]) != NULL);
+  }
+  janet_arity(argc, 1, 2);
+  const SortedNode *node = sorted_find(CAST_SORTED(data)->root, argv[0]);
+  if (node != NULL) {
+    return node->value;
+  } else if (argc == 2) {
+    return argv[1];
+  } else {
+    janet_panicf("key %v not found", argv[0]);
+  }
+}
+
+static void sorted_tostring(void *data, JanetBuffer *buffer) {
+  bool is_map = CAST_SORTED(data)->is_map;
+  janet_buffer_push_cstring(buffer, "{");
+  int first = 1;
+  sorted_for_each(CAST_SORTED(data)->root, [&](const SortedNode *node) {
+    if (first) {
+      first = 0;
+    } else {
+      janet_buffer_push_cstring(buffer, " ");
+    }
+    janet_pretty(buffer, 0, 0, node->key);
+    if (is_map) {
+      janet_buffer_push_cstring(buffer, " ");
+      janet_pretty(buffer, 0, 0, node->value);
+    }
+  });
+  janet_buffer_push_cstring(buffer, "}");
+}
+
+static int sorted_compare(void *data1, void *data2) {
+  auto box1 = CAST_SORTED(data1);
+  auto box2 = CAST_SORTED(data2);
+  if (box1->root == box2->root) {
+    return 0;
+  }
+  if (!hashes_differ(box1->hash, box2->hash) && sorted_size(box1->root) == sorted_size(box2->root)) {
+    std::vector<const SortedNode *> nodes1, nodes2;
+    sorted_for_each(box1->root, [&](const SortedNode *node) { nodes1.push_back(node); });
+    sorted_for_each(box2->root, [&](const SortedNode *node) { nodes2.push_back(node); });
+    bool equal = true;
+    for (size_t i = 0; equal && i < nodes1.size(); i++) {
+      equal = janet_equals(nodes1[i]->key, nodes2[i]->key) && janet_equals(nodes1[i]->value, nodes2[i]->value);
+    }
+    if (equal) {
+      return 0;
+    }
+  }
+  return box1 > box2 ? 1 : -1;
+}
+
+static int32_t sorted_hash(void *data, size_t len) {
+  (void) len;
+  auto box = CAST_SORTED(data);
+  if (!box->hash.valid) {
+    bool is_map = CAST_SORTED(data)->is_map;
+    uint32_t hash = is_map ? 0x50a7ed3a : 0x50a7ed5e;
+    sorted_for_each(box->root, [&](const SortedNode *node) {
+      hash += is_map ? map_entry_hash(node->key, node->value) : set_element_hash(node->key);
+    });
+    box->hash.value = hash;
+    box->hash.valid = true;
+  }
+  return static_cast<int32_t>(box->hash.value);
+}
+
+static void sorted_marshal(void *data, JanetMarshalContext *ctx) {
+  janet_marshal_abstract(ctx, data);
+  bool is_map = CAST_SORTED(data)->is_map;
+  auto box = CAST_SORTED(data);
+  janet_marshal_int(ctx, static_cast<int32_t>(sorted_size(box->root)));
+  sorted_for_each(box->root, [&](const SortedNode *node) {
+    janet_marshal_janet(ctx, node->key);
+    if (is_map) {
+      janet_marshal_janet(ctx, node->value);
+    }
+  });
+}
+
+// The tree belongs to the abstract as soon as it exists, so if unmarshaling
+// panics partway through, the abstract's finalizer still frees it.
+static void *sorted_unmarshal_as(JanetMarshalContext *ctx, bool is_map) {
+  auto box = CAST_SORTED(new (janet_unmarshal_abstract(ctx, sizeof(SortedBox))) SortedBox());
+  box->root = NULL;
+  box->is_map = is_map;
+  int32_t size = janet_unmarshal_int(ctx);
+  for (int32_t i = 0; i < size; i++) {
+    Janet key = janet_unmarshal_janet(ctx);
+    Janet value = is_map ? janet_unmarshal_janet(ctx) : key;
+    if (janet_checktype(key, JANET_NIL)) {
+      janet_panic("sorted collections cannot contain nil");
+    }
+    SortedNode *root = sorted_insert(box->root, key, value, sorted_priority(key));
+    sorted_release(box->root);
+    box->root = root;
+  }
+  return box;
+}
+
+static void *sorted_set_unmarshal(JanetMarshalContext *ctx) {
+  return sorted_unmarshal_as(ctx, false);
+}
+
+static void *sorted_map_unmarshal(JanetMarshalContext *ctx) {
+  return sorted_unmarshal_as(ctx, true);
+}
+
+static const JanetAbstractType sorted_set_type = {
+  .name = "jimmy/sorted-set",
+  .gc = sorted_gc,
+  .gcmark = sorted_gcmark,
+  .get = sorted_get,
+  .put = NULL,
+  .marshal = sorted_marshal,
+  .unmarshal = sorted_set_unmarshal,
+  .tostring = sorted_tostring,
+  .compare = sorted_compare,
+  .hash = sorted_hash,
+  .next = sorted_next,
+  .call = sorted_call,
+};
+
+static const JanetAbstractType sorted_map_type = {
+  .name = "jimmy/sorted-map",
+  .gc = sorted_gc,
+  .gcmark = sorted_gcmark,
+  .get = sorted_get,
+  .put = NULL,
+  .marshal = sorted_marshal,
+  .unmarshal = sorted_map_unmarshal,
+  .tostring = sorted_tostring,
+  .compare = sorted_compare,
+  .hash = sorted_hash,
+  .next = sorted_next,
+  .call = sorted_call,
+};
+
+// Functions
+
+static Janet sorted_wrap(const JanetAbstractType *type, SortedNode *root) {
+  mark_arm();
+  auto box = CAST_SORTED(new (janet_abstract(type, sizeof(SortedBox))) SortedBox());
+  box->root = root;
+  box->is_map = type == &sorted_map_type;
+  return janet_wrap_abstract(box);
+}
+
+static void sorted_check_key(Janet key) {
+  if (janet_checktype(key, JANET_NIL)) {
+    janet_panic("sorted collections cannot contain nil");
+  }
+}
+
+static SortedBox *sorted_getbox(const Janet *argv, int32_t n) {
+  Janet x = argv[n];
+  if (!janet_checkabstract(x, &sorted_set_type) && !janet_checkabstract(x, &sorted_map_type)) {
+    janet_panicf("bad slot #%d, expected jimmy/sorted-set or jimmy/sorted-map, got %v", n, x);
+  }
+  return CAST_SORTED(janet_unwrap_abstract(x));
+}
+
+static const JanetAbstractType *sorted_type_of(const Janet *argv, int32_t n) {
+  return janet_abstract_type(sorted_getbox(argv, n));
+}
+
+// Inserts every pair of `kvs` into `root`, which it borrows.
+static SortedNode *sorted_insert_all(SortedNode *root, const Janet *kvs, int32_t count, bool is_map) {
+  int32_t stride = is_map ? 2 : 1;
+  for (int32_t i = 0; i < count; i += stride) {
+    sorted_check_key(kvs[i]);
+  }
+  root = sorted_retain(root);
+  for (int32_t i = 0; i < count; i += stride) {
+    SortedNode *next = sorted_insert(root, kvs[i], kvs[i + stride - 1], sorted_priority(kvs[i]));
+    sorted_release(root);
+    root = next;
+  }
+  return root;
+}
+
+static Janet cfun_sorted_set(int32_t argc, Janet *argv) {
+  return sorted_wrap(&sorted_set_type, sorted_insert_all(NULL, argv, argc, false));
+}
+
+static Janet cfun_sorted_map(int32_t argc, Janet *argv) {
+  if (argc % 2 != 0) {
+    janet_panic("expected even number of arguments");
+  }
+  return sorted_wrap(&sorted_map_type, sorted_insert_all(NULL, argv, argc, true));
+}
+
+static Janet cfun_sorted_set_of(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  Janet iterable = argv[0];
+  if (janet_checkabstract(iterable, &sorted_set_type)) {
+    return iterable;
+  }
+  JanetArray *elements = janet_array(0);
+  Janet key = janet_wrap_nil();
+  while (true) {
+    key = janet_next(iterable, key);
+    if (janet_checktype(key, JANET_NIL)) {
+      break;
+    }
+    janet_array_push(elements, janet_in(iterable, key));
+  }
+  return sorted_wrap(&sorted_set_type, sorted_insert_all(NULL, elements->data, elements->count, false));
+}
+
+static Janet cfun_sorted_map_of(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  Janet dict = argv[0];
+  if (janet_checkabstract(dict, &sorted_map_type)) {
+    return dict;
+  }
+  JanetArray *kvs = janet_array(0);
+  if (janet_checkabstract(dict, &map_type)) {
+    for (auto pair : *CAST_MAP(janet_unwrap_abstract(dict))) {
+      janet_array_push(kvs, pair.first);
+      janet_array_push(kvs, pair.second);
+    }
+  } else {
+    const JanetKV *entries;
+    int32_t length, capacity;
+    if (!janet_dictionary_view(dict, &entries, &length, &capacity)) {
+      janet_panicf("expected table, struct or jimmy/map, got %v", dict);
+    }
+    for (int32_t i = 0; i < capacity; i++) {
+      if (!janet_checktype(entries[i].key, JANET_NIL)) {
+        janet_array_push(kvs, entries[i].key);
+        janet_array_push(kvs, entries[i].value);
+      }
+    }
+  }
+  return sorted_wrap(&sorted_map_type, sorted_insert_all(NULL, kvs->data, kvs->count, true));
+}
+
+static Janet cfun_sorted_add(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto set = CAST_SORTED(janet_getabstract(argv, 0, &sorted_set_type));
+  return sorted_wrap(&sorted_set_type, sorted_insert_all(set->root, argv + 1, argc - 1, false));
+}
+
+static Janet cfun_sorted_put(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto map = CAST_SORTED(janet_getabstract(argv, 0, &sorted_map_type));
+  if ((argc - 1) % 2 != 0) {
+    janet_panic("expected even number of key-value arguments");
+  }
+  return sorted_wrap(&sorted_map_type, sorted_insert_all(map->root, argv + 1, argc - 1, true));
+}
+
+static Janet cfun_sorted_remove(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto box = sorted_getbox(argv, 0);
+  SortedNode *root = sorted_retain(box->root);
+  for (int32_t i = 1; i < argc; i++) {
+    if (sorted_find(root, argv[i]) != NULL) {
+      SortedNode *next = sorted_remove(root, argv[i]);
+      sorted_release(root);
+      root = next;
+    }
+  }
+  return sorted_wrap(sorted_type_of(argv, 0), root);
+}
+
+static Janet cfun_sorted_range(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+  auto box = sorted_getbox(argv, 0);
+  Janet low = argv[1];
+  Janet high = argv[2];
+  SortedNode *root = sorted_retain(box->root);
+  if (!janet_checktype(low, JANET_NIL)) {
+    SortedNode *below, *rest;
+    sorted_split(root, low, &below, &rest);
+    sorted_release(below);
+    sorted_release(root);
+    root = rest;
+  }
+  if (!janet_checktype(high, JANET_NIL)) {
+    SortedNode *rest, *above;
+    sorted_split(root, high, &rest, &above);
+    sorted_release(above);
+    sorted_release(root);
+    root = rest;
+  }
+  return sorted_wrap(sorted_type_of(argv, 0), root);
+}
+
+static Janet sorted_key_or_nil(const SortedNode *node) {
+  return node == NULL ? janet_wrap_nil() : node->key;
+}
+
+static Janet cfun_sorted_floor(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  return sorted_key_or_nil(sorted_floor(sorted_getbox(argv, 0)->root, argv[1], true));
+}
+
+static Janet cfun_sorted_ceiling(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  return sorted_key_or_nil(sorted_ceiling(sorted_getbox(argv, 0)->root, argv[1], true));
+}
+
+static Janet cfun_sorted_first(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return sorted_key_or_nil(sorted_select(sorted_getbox(argv, 0)->root, 0));
+}
+
+static Janet cfun_sorted_last(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto root = sorted_getbox(argv, 0)->root;
+  return sorted_key_or_nil(root == NULL ? NULL : sorted_select(root, root->size - 1));
+}
+
+static Janet cfun_sorted_rank(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  return janet_wrap_number(static_cast<double>(sorted_rank(sorted_getbox(argv, 0)->root, argv[1])));
+}
+
+static Janet cfun_sorted_select(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto root = sorted_getbox(argv, 0)->root;
+  size_t rank = janet_getsize(argv, 1);
+  return sorted_key_or_nil(sorted_select(root, rank));
+}
+
+static Janet cfun_sorted_take(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto box = sorted_getbox(argv, 0);
+  size_t n = janet_getsize(argv, 1);
+  SortedNode *taken, *rest;
+  sorted_split_at(box->root, n, &taken, &rest);
+  sorted_release(rest);
+  return sorted_wrap(sorted_type_of(argv, 0), taken);
+}
+
+static Janet cfun_sorted_drop(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto box = sorted_getbox(argv, 0);
+  size_t n = janet_getsize(argv, 1);
+  SortedNode *dropped, *rest;
+  sorted_split_at(box->root, n, &dropped, &rest);
+  sorted_release(dropped);
+  return sorted_wrap(sorted_type_of(argv, 0), rest);
+}
+
+static Janet cfun_sorted_split(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto box = sorted_getbox(argv, 0);
+  auto type = sorted_type_of(argv, 0);
+  SortedNode *below, *rest;
+  sorted_split(box->root, argv[1], &below, &rest);
+  Janet *result = janet_tuple_begin(2);
+  result[0] = sorted_wrap(type, below);
+  result[1] = sorted_wrap(type, rest);
+  return janet_wrap_tuple(janet_tuple_end(result));
+}
+
+static Janet cfun_sorted_join(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  auto left = sorted_getbox(argv, 0);
+  auto type = sorted_type_of(argv, 0);
+  auto right = CAST_SORTED(janet_getabstract(argv, 1, type));
+  if (left->root != NULL && right->root != NULL) {
+    Janet last = sorted_select(left->root, left->root->size - 1)->key;
+    Janet first = sorted_select(right->root, 0)->key;
+    if (janet_compare(last, first) >= 0) {
+      janet_panicf("expected every key of the first collection to be less than %v, got %v", first, last);
+    }
+  }
+  return sorted_wrap(type, sorted_join(left->root, right->root));
+}
+
+static const JanetReg sorted_cfuns[] = {
+  {"sorted/set", cfun_sorted_set, "(sorted/set & xs)\n\n"
+    "Returns a persistent immutable set containing only the listed elements, kept in the order given by `compare`. "
+    "Sorted sets cannot contain `nil`."},
+  {"sorted/map", cfun_sorted_map, "(sorted/map & kvs)\n\n"
+    "Returns a persistent immutable map containing only the listed key-value pairs, kept in the order of their keys. "
+    "Sorted maps cannot contain `nil` keys."},
+  {"sorted/set-of", cfun_sorted_set_of, "(sorted/set-of iterable)\n\n"
+    "Returns a sorted set of all the values in an iterable data structure."},
+  {"sorted/map-of", cfun_sorted_map_of, "(sorted/map-of dict)\n\n"
+    "Returns a sorted map of all the entries in a table, struct or jimmy map."},
+  {"sorted/add", cfun_sorted_add, "(sorted/add set & xs)\n\n"
+    "Returns a new sorted set containing all of the elements from the original set and all of the subsequent arguments."},
+  {"sorted/put", cfun_sorted_put, "(sorted/put map & kvs)\n\n"
+    "Returns a new sorted map with all of the subsequent key-value pairs added, replacing any existing values."},
+  {"sorted/remove", cfun_sorted_remove, "(sorted/remove coll & keys)\n\n"
+    "Returns a new sorted set or map without any of the given keys."},
+  {"sorted/range", cfun_sorted_range, "(sorted/range coll low high)\n\n"
+    "Returns a new sorted set or map containing only the keys `k` with `low <= k < high`. "
+    "Either bound can be `nil` to leave that side open. This takes O(log n) time and shares its entries with the original."},
+  {"sorted/floor", cfun_sorted_floor, "(sorted/floor coll key)\n\n"
+    "Returns the greatest key that is less than or equal to `key`, or `nil` if there is none."},
+  {"sorted/ceiling", cfun_sorted_ceiling, "(sorted/ceiling coll key)\n\n"
+    "Returns the least key that is greater than or equal to `key`, or `nil` if there is none."},
+  {"sorted/first", cfun_sorted_first, "(sorted/first coll)\n\n"
+    "Returns the least key, or `nil` if the collection is empty."},
+  {"sorted/last", cfun_sorted_last, "(sorted/last coll)\n\n"
+    "Returns the greatest key, or `nil` if the collection is empty."},
+  {"sorted/rank", cfun_sorted_rank, "(sorted/rank coll key)\n\n"
+    "Returns the number of keys less than `key`."},
+  {"sorted/select", cfun_sorted_select, "(sorted/select coll rank)\n\n"
+    "Returns the key with exactly `rank` keys before it, or `nil` if `rank` is out of range."},
+  {"sorted/take", cfun_sorted_take, "(sorted/take coll n)\n\n"
+    "Returns a new sorted set or map with only the `n` least keys."},
+  {"sorted/drop", cfun_sorted_drop, "(sorted/drop coll n)\n\n"
+    "Returns a new sorted set or map without the `n` least keys."},
+  {"sorted/split", cfun_sorted_split, "(sorted/split coll key)\n\n"
+    "Returns a tuple of two sorted collections: one with the keys less than `key`, and one with the rest. "
+    "This takes O(log n) time."},
+  {"sorted/join", cfun_sorted_join, "(sorted/join left right)\n\n"
+    "Returns a sorted collection with the keys of both arguments, which must be of the same type, "
+    "and every key of `left` must be less than every key of `right`. This takes O(log n) time."},
+  {NULL, NULL, NULL}
+};
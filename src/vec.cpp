@@ -1,16 +1,30 @@
-#include <immer/vector.hpp>
-#include <immer/vector_transient.hpp>
+#include <immer/flex_vector.hpp>
+#include <immer/flex_vector_transient.hpp>
+
+// A flex_vector is a relaxed radix balanced tree, so on top of everything a
+// plain immer::vector can do, it can concatenate, slice, and insert or remove
+// elements anywhere in logarithmic time.
+typedef immer::flex_vector<Janet, MemoryPolicy> Vec;
+typedef immer::flex_vector_transient<Janet, MemoryPolicy> TVec;
+
+// The abstract holds the vector along with its cached hash. Everything that
+// doesn't care about the hash can treat it as a plain Vec.
+struct VecBox : Vec {
+  HashCache hash;
+};
 
-#define CAST_VEC(expr) static_cast<immer::vector<Janet> *>((expr))
-#define NEW_VEC() new (janet_abstract(&vec_type, sizeof(immer::vector<Janet>))) immer::vector<Janet>()
+// Value-initializing a VecBox zeroes its hash cache.
+#define CAST_VEC_BOX(expr) static_cast<VecBox *>((expr))
+#define CAST_VEC(expr) static_cast<Vec *>(CAST_VEC_BOX(expr))
+#define NEW_VEC() CAST_VEC((mark_arm(), new (janet_abstract(&vec_type, sizeof(VecBox))) VecBox()))
 
-#define CAST_TVEC(expr) static_cast<immer::vector_transient<Janet> *>((expr))
-#define NEW_TVEC() new (janet_abstract(&tvec_type, sizeof(immer::vector_transient<Janet>))) immer::vector_transient<Janet>()
+#define CAST_TVEC(expr) static_cast<TVec *>((expr))
+#define NEW_TVEC() new (janet_abstract(&tvec_type, sizeof(TVec))) TVec()
 
 static int tvec_gc(void *data, size_t len) {
   (void) len;
   auto tvec = CAST_TVEC(data);
-  tvec->~vector_transient();
+  tvec->~flex_vector_transient();
   return 0;
 }
 
@@ -32,17 +46,15 @@ static const JanetAbstractType tvec_type = {
 
 static int vec_gc(void *data, size_t len) {
   (void) len;
-  auto vec = CAST_VEC(data);
-  vec->~vector();
+  auto box = CAST_VEC_BOX(data);
+  box->~VecBox();
   return 0;
 }
 
 static int vec_gcmark(void *data, size_t len) {
   (void) len;
   auto vec = CAST_VEC(data);
-  for (auto el : *vec) {
-    janet_mark(el);
-  }
+  mark_vector(*vec);
   return 0;
 }
 
@@ -113,45 +125,128 @@ static Janet vec_call(void *data, int32_t argc, Janet *argv) {
   return (*vec)[index];
 }
 
+static thread_local MarshalHistory<Vec> vec_marshal_history;
+static thread_local MarshalHistory<Vec> vec_unmarshal_history;
+
+// Vecs usually change at the end, so a delta is the length of the prefix
+// shared with the base, followed by everything after it.
+static size_t shared_prefix(const Vec &a, const Vec &b) {
+  auto limit = a.size() < b.size() ? a.size() : b.size();
+  size_t i = 0;
+  auto it_a = a.begin();
+  auto it_b = b.begin();
+  while (i < limit && janet_equals(*it_a, *it_b)) {
+    ++it_a;
+    ++it_b;
+    i++;
+  }
+  return i;
+}
+
 static void vec_marshal(void *data, JanetMarshalContext *ctx) {
   janet_marshal_abstract(ctx, data);
+  janet_marshal_int64(ctx, MARSHAL_FORMAT);
+  marshal_begin(ctx);
   auto vec = CAST_VEC(data);
-  janet_marshal_size(ctx, vec->size());
-  for (auto el : *vec) {
+  auto &history = vec_marshal_history.current(marshal_generation);
+
+  if (marshal_shareable(ctx) && marshal_every(*vec, marshal_immediate)) {
+    marshal_share(ctx, *vec);
+    history.push_back(vec);
+    return;
+  }
+
+  int32_t base = MARSHAL_NO_BASE;
+  size_t prefix = 0;
+  for (size_t i = history.size(), tried = 0; i > 0 && tried < MARSHAL_BASE_CANDIDATES; i--) {
+    auto candidate = history[i - 1];
+    if (!similar_size(*candidate, *vec)) {
+      continue;
+    }
+    tried++;
+    prefix = shared_prefix(*candidate, *vec);
+    if (vec->size() - prefix < vec->size() / 2) {
+      base = static_cast<int32_t>(i - 1);
+      break;
+    }
+  }
+
+  janet_marshal_int(ctx, base);
+  if (base == MARSHAL_NO_BASE) {
+    prefix = 0;
+  } else {
+    janet_marshal_size(ctx, prefix);
+  }
+  janet_marshal_size(ctx, vec->size() - prefix);
+  for (auto el : vec->drop(prefix)) {
     janet_marshal_janet(ctx, el);
   }
+  history.push_back(vec);
 }
 
-static void *vec_unmarshal(JanetMarshalContext *ctx) {
-  auto vec = CAST_VEC(janet_unmarshal_abstract(ctx, sizeof(immer::vector<Janet>)));
-  new (vec) immer::vector<Janet>();
+static void vec_unmarshal_elements(JanetMarshalContext *ctx, Vec *vec, size_t size) {
   auto transient = vec->transient();
-  size_t size = janet_unmarshal_size(ctx);
   for (size_t i = 0; i < size; i++) {
     transient.push_back(janet_unmarshal_janet(ctx));
   }
   *vec = transient.persistent();
+}
+
+static void *vec_unmarshal(JanetMarshalContext *ctx) {
+  auto vec = CAST_VEC(new (janet_unmarshal_abstract(ctx, sizeof(VecBox))) VecBox());
+  int64_t format = janet_unmarshal_int64(ctx);
+  if (format < 0 && format != MARSHAL_FORMAT) {
+    janet_panicf("invalid collection format %d", static_cast<int32_t>(format));
+  }
+  if (format != MARSHAL_FORMAT) {
+    vec_unmarshal_elements(ctx, vec, static_cast<size_t>(format));
+    return vec;
+  }
+  unmarshal_begin(ctx);
+  auto &history = vec_unmarshal_history.current(unmarshal_generation);
+  int32_t base = unmarshal_base(ctx, history.size());
+  if (base == MARSHAL_SHARED) {
+    unmarshal_share(ctx, *vec);
+    history.push_back(vec);
+    return vec;
+  } else if (base != MARSHAL_NO_BASE) {
+    size_t prefix = janet_unmarshal_size(ctx);
+    if (prefix > history[base]->size()) {
+      janet_panicf("invalid delta prefix %d", static_cast<int32_t>(prefix));
+    }
+    *vec = history[base]->take(prefix);
+  }
+  vec_unmarshal_elements(ctx, vec, janet_unmarshal_size(ctx));
+  history.push_back(vec);
   return vec;
 }
 
 static int vec_compare(void *data1, void *data2) {
   auto vec1 = CAST_VEC(data1);
   auto vec2 = CAST_VEC(data2);
-  if (*vec1 == *vec2) {
+  if (!hashes_differ(CAST_VEC_BOX(vec1)->hash, CAST_VEC_BOX(vec2)->hash) && *vec1 == *vec2) {
     return 0;
   }
   return vec1 > vec2 ? 1 : -1;
 }
 
+static uint32_t vec_hash_push(uint32_t hash, Janet el) {
+  return hash_mix(hash, static_cast<int32_t>(std::hash<Janet>()(el)));
+}
+
 static int32_t vec_hash(void *data, size_t len) {
   (void) len;
-  auto vec = CAST_VEC(data);
-  // start with a random value
-  uint32_t hash = 0x6bd33241;
-  for (auto el : *vec) {
-    hash = hash_mix(hash, static_cast<int32_t>(std::hash<Janet>()(el)));
+  auto box = CAST_VEC_BOX(data);
+  if (!box->hash.valid) {
+    // start with a random value
+    uint32_t hash = 0x6bd33241;
+    for (auto el : *box) {
+      hash = vec_hash_push(hash, el);
+    }
+    box->hash.value = hash;
+    box->hash.valid = true;
   }
-  return hash;
+  return static_cast<int32_t>(box->hash.value);
 }
 
 static const JanetAbstractType vec_type = {
@@ -179,20 +274,54 @@ static Janet cfun_vec_new(int32_t argc, Janet *argv) {
   return janet_wrap_abstract(vec);
 }
 
+static bool set_insert_vec(Janet source, TSet *transient) {
+  if (!janet_checkabstract(source, &vec_type)) {
+    return false;
+  }
+  auto vec = CAST_VEC(janet_unwrap_abstract(source));
+  std::vector<Janet> values;
+  values.reserve(vec->size());
+  immer::for_each_chunk(*vec, [&](const Janet *first, const Janet *last) {
+    values.insert(values.end(), first, last);
+  });
+  set_insert_all(*transient, values.data(), static_cast<int32_t>(values.size()));
+  return true;
+}
+
 static Janet cfun_vec_of(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
   Janet iterable = argv[0];
+  // Vectors are immutable, so a vector can stand in for a copy of itself.
+  if (janet_checkabstract(iterable, &vec_type)) {
+    return iterable;
+  }
   auto vec = NEW_VEC();
   auto transient = NEW_TVEC();
   *transient = vec->transient();
 
-  Janet key = janet_wrap_nil();
-  while (true) {
-    key = janet_next(iterable, key);
-    if (janet_checktype(key, JANET_NIL)) {
-      break;
+  // Walk the common collections directly, instead of paying for a call to
+  // `next` and a lookup for every element.
+  const Janet *items;
+  int32_t length;
+  if (janet_indexed_view(iterable, &items, &length)) {
+    for (int32_t i = 0; i < length; i++) {
+      transient->push_back(items[i]);
+    }
+  } else if (janet_checkabstract(iterable, &set_type)) {
+    immer::for_each_chunk(*CAST_SET(janet_unwrap_abstract(iterable)), [&](const Janet *first, const Janet *last) {
+      for (; first != last; first++) {
+        transient->push_back(*first);
+      }
+    });
+  } else {
+    Janet key = janet_wrap_nil();
+    while (true) {
+      key = janet_next(iterable, key);
+      if (janet_checktype(key, JANET_NIL)) {
+        break;
+      }
+      transient->push_back(janet_in(iterable, key));
     }
-    transient->push_back(janet_in(iterable, key));
   }
 
   *vec = transient->persistent();
@@ -214,6 +343,19 @@ static Janet cfun_vec_push(int32_t argc, Janet *argv) {
     }
     *new_vec = transient.persistent();
   }
+
+  // The hash is a left fold over the elements, so pushing onto a vector
+  // whose hash we already know only needs to hash the new elements.
+  auto old_hash = CAST_VEC_BOX(old_vec)->hash;
+  if (old_hash.valid) {
+    auto new_box = CAST_VEC_BOX(new_vec);
+    uint32_t hash = old_hash.value;
+    for (int32_t i = 1; i < argc; i++) {
+      hash = vec_hash_push(hash, argv[i]);
+    }
+    new_box->hash.value = hash;
+    new_box->hash.valid = true;
+  }
   return janet_wrap_abstract(new_vec);
 }
 
@@ -248,6 +390,36 @@ static Janet cfun_vec_popn(int32_t argc, Janet *argv) {
   return janet_wrap_abstract(new_vec);
 }
 
+// Together with `vec/push` and `vec/pop`, these let a vector serve as a
+// persistent deque: the tree is relaxed, so growing or shrinking it at the
+// front touches only the leftmost path instead of shifting every element.
+static Janet cfun_vec_push_front(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, -1);
+  auto old_vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  auto new_vec = NEW_VEC();
+  if (argc == 2) {
+    *new_vec = old_vec->push_front(argv[1]);
+  } else {
+    auto transient = Vec().transient();
+    for (int32_t i = 1; i < argc; i++) {
+      transient.push_back(argv[i]);
+    }
+    *new_vec = transient.persistent() + *old_vec;
+  }
+  return janet_wrap_abstract(new_vec);
+}
+
+static Janet cfun_vec_pop_front(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto old_vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  if (old_vec->empty()) {
+    return argv[0];
+  }
+  auto new_vec = NEW_VEC();
+  *new_vec = old_vec->drop(1);
+  return janet_wrap_abstract(new_vec);
+}
+
 static Janet cfun_vec_put(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 3);
   size_t n = janet_getsize(argv, 1);
@@ -260,6 +432,87 @@ static Janet cfun_vec_put(int32_t argc, Janet *argv) {
   return janet_wrap_abstract(new_vec);
 }
 
+static Janet cfun_vec_drop(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  size_t n = janet_getsize(argv, 1);
+  auto old_vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  auto new_vec = NEW_VEC();
+  if (n < old_vec->size()) {
+    *new_vec = old_vec->drop(n);
+  }
+  return janet_wrap_abstract(new_vec);
+}
+
+// Negative indices count from the end, like Janet's `slice`: -1 is the end
+// of the vector.
+static size_t vec_slice_index(Janet *argv, int32_t n, size_t size) {
+  int64_t index = janet_getinteger64(argv, n);
+  int64_t resolved = index < 0 ? static_cast<int64_t>(size) + index + 1 : index;
+  if (resolved < 0 || resolved > static_cast<int64_t>(size)) {
+    janet_panicf("index %v out of range for vector of length %d", argv[n], size);
+  }
+  return static_cast<size_t>(resolved);
+}
+
+static Janet cfun_vec_slice(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 3);
+  auto old_vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  size_t size = old_vec->size();
+  size_t start = argc > 1 ? vec_slice_index(argv, 1, size) : 0;
+  size_t end = argc > 2 ? vec_slice_index(argv, 2, size) : size;
+  auto new_vec = NEW_VEC();
+  if (start < end) {
+    *new_vec = old_vec->take(end).drop(start);
+  }
+  return janet_wrap_abstract(new_vec);
+}
+
+static Janet cfun_vec_concat(int32_t argc, Janet *argv) {
+  for (int32_t i = 0; i < argc; i++) {
+    janet_getabstract(argv, i, &vec_type);
+  }
+  auto new_vec = NEW_VEC();
+  for (int32_t i = 0; i < argc; i++) {
+    *new_vec = *new_vec + *CAST_VEC(janet_unwrap_abstract(argv[i]));
+  }
+  return janet_wrap_abstract(new_vec);
+}
+
+static Janet cfun_vec_insert(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, -1);
+  size_t n = janet_getsize(argv, 1);
+  auto old_vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  if (n > old_vec->size()) {
+    janet_panicf("expected integer key in range [0, %d], got %v", old_vec->size(), argv[1]);
+  }
+  auto new_vec = NEW_VEC();
+  int32_t new_elements = argc - 2;
+  if (new_elements == 1) {
+    *new_vec = old_vec->insert(n, argv[2]);
+  } else {
+    auto middle = Vec().transient();
+    for (int32_t i = 2; i < argc; i++) {
+      middle.push_back(argv[i]);
+    }
+    *new_vec = old_vec->take(n) + middle.persistent() + old_vec->drop(n);
+  }
+  return janet_wrap_abstract(new_vec);
+}
+
+static Janet cfun_vec_remove_at(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+  size_t n = janet_getsize(argv, 1);
+  size_t count = argc > 2 ? janet_getsize(argv, 2) : 1;
+  auto old_vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  if (n >= old_vec->size()) {
+    janet_panicf("expected integer key in range [0, %d), got %v", old_vec->size(), argv[1]);
+  }
+  size_t end = count < old_vec->size() - n ? n + count : old_vec->size();
+  auto new_vec = NEW_VEC();
+  *new_vec = old_vec->erase(n, end);
+  return janet_wrap_abstract(new_vec);
+}
+
 static Janet cfun_vec_first(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
   auto vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
@@ -278,14 +531,15 @@ static Janet cfun_vec_last(int32_t argc, Janet *argv) {
   return vec->back();
 }
 
+// Copies a leaf at a time.
 static Janet cfun_vec_to_tuple(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
   auto vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
   Janet *result = janet_tuple_begin(vec->size());
-  size_t i = 0;
-  for (auto el : *vec) {
-    result[i++] = el;
-  }
+  Janet *out = result;
+  immer::for_each_chunk(*vec, [&](const Janet *first, const Janet *last) {
+    out = std::copy(first, last, out);
+  });
   return janet_wrap_tuple(janet_tuple_end(result));
 }
 
@@ -293,9 +547,10 @@ static Janet cfun_vec_to_array(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
   auto vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
   JanetArray *result = janet_array(vec->size());
-  for (auto el : *vec) {
-    janet_array_push(result, el);
-  }
+  immer::for_each_chunk(*vec, [&](const Janet *first, const Janet *last) {
+    std::copy(first, last, result->data + result->count);
+    result->count += static_cast<int32_t>(last - first);
+  });
   return janet_wrap_array(result);
 }
 
@@ -349,6 +604,38 @@ static Janet cfun_vec_filter_map(int32_t argc, Janet *argv) {
   return janet_wrap_abstract(new_vec);
 }
 
+// Walks the leaves of the vector directly, instead of looking up every index
+// from the root like `next` does.
+static Janet cfun_vec_each(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (view_each(argv[0], &vec_type, argv[1], false)) {
+    return janet_wrap_nil();
+  }
+  auto vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  auto f = argv[1];
+  immer::for_each_chunk(*vec, [&](const Janet *first, const Janet *last) {
+    for (; first != last; first++) {
+      Janet el = *first;
+      call_callable(f, 1, &el);
+    }
+  });
+  return janet_wrap_nil();
+}
+
+static Janet cfun_vec_each_chunk(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (view_each(argv[0], &vec_type, argv[1], true)) {
+    return janet_wrap_nil();
+  }
+  auto vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
+  auto f = argv[1];
+  immer::for_each_chunk(*vec, [&](const Janet *first, const Janet *last) {
+    Janet chunk = janet_wrap_tuple(janet_tuple_n(first, static_cast<int32_t>(last - first)));
+    call_callable(f, 1, &chunk);
+  });
+  return janet_wrap_nil();
+}
+
 static Janet cfun_vec_reduce(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 3);
   auto vec = CAST_VEC(janet_getabstract(argv, 0, &vec_type));
@@ -388,8 +675,25 @@ static const JanetReg vec_cfuns[] = {
    "Returns a new vector with the last element removed."},
   {"vec/popn", cfun_vec_popn, "(vec/popn vec)\n\n"
    "Returns a new vector with the last n elements removed."},
+  {"vec/push-front", cfun_vec_push_front, "(vec/push-front vec & xs)\n\n"
+   "Returns a new vector with the subsequent arguments, in order, followed by all of the elements from the original. "
+   "Takes logarithmic time in the size of the vector, so a vector works as a persistent deque."},
+  {"vec/pop-front", cfun_vec_pop_front, "(vec/pop-front vec)\n\n"
+   "Returns a new vector with the first element removed. Takes logarithmic time in the size of the vector."},
   {"vec/put", cfun_vec_put, "(vec/put vec n val)\n\n"
    "Returns a new vector with nth element set to val."},
+  {"vec/drop", cfun_vec_drop, "(vec/drop vec n)\n\n"
+   "Returns a new vector without the first n elements of vec, or an empty vector if n >= (length vec)."},
+  {"vec/slice", cfun_vec_slice, "(vec/slice vec &opt start end)\n\n"
+   "Returns a new vector containing the elements from `start` up to but not including `end`. "
+   "Negative indices count from the end of the vector, like Janet's `slice`."},
+  {"vec/concat", cfun_vec_concat, "(vec/concat & vecs)\n\n"
+   "Returns a new vector containing the elements of every argument, in order. "
+   "Takes logarithmic time in the size of the vectors."},
+  {"vec/insert", cfun_vec_insert, "(vec/insert vec n & xs)\n\n"
+   "Returns a new vector with the subsequent arguments inserted before the nth element."},
+  {"vec/remove-at", cfun_vec_remove_at, "(vec/remove-at vec n &opt count)\n\n"
+   "Returns a new vector without the `count` elements starting at the nth element. `count` defaults to 1."},
   {"vec/first", cfun_vec_first, "(vec/first vec)\n\n"
    "Returns the first element of the vector."},
   {"vec/last", cfun_vec_last, "(vec/last vec)\n\n"
@@ -406,6 +710,14 @@ static const JanetReg vec_cfuns[] = {
     "Returns a vector containing only the elements for which the predicate returns a truthy value. "
     "`pred` can be any callable value, not just a function.\n\n"
     "Note that the arguments are in the opposite order of Janet's `filter` function."},
+  {"vec/each", cfun_vec_each, "(vec/each vec f)\n\n"
+    "Calls `f` on every element of the vector or map view, in order, and returns `nil`. "
+    "This is faster than iterating over the vector with `each`, because it doesn't have to look up each index. "
+    "`f` can be any callable value, not just a function."},
+  {"vec/each-chunk", cfun_vec_each_chunk, "(vec/each-chunk vec f)\n\n"
+    "Calls `f` with a tuple of consecutive elements for every leaf of the vector or map view, in order, and returns `nil`. "
+    "Chunks usually hold 32 elements, but vectors built by slicing or concatenation can have shorter chunks anywhere. "
+    "`f` can be any callable value, not just a function."},
   {"vec/reduce", cfun_vec_reduce, "(vec/reduce vec init f)\n\n"
     "Returns a reduction of the elements in the vector. `f` can be any callable value, not just a function.\n\n"
     "Note that the arguments are in a different order than Janet's `reduce` function."},
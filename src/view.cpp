@@ -0,0 +1,397 @@
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Lazy views over a vec or a set. Creating a view is O(1): the function only
+// runs on the elements that are actually accessed. A memoizing view
+// remembers every result in a sparse cache, so each element is computed at
+// most once. Realizing a view builds a real collection, which the view then
+// keeps and reads from instead of calling the function again.
+
+typedef enum {
+  VecMapView,
+  SetFilterView,
+} ViewKind;
+
+typedef struct {
+  ViewKind kind;
+  bool memoize;
+  Janet source;
+  Janet f;
+  Janet realized;
+  std::unordered_map<size_t, Janet> mapped;
+  std::unordered_map<Janet, bool> filtered;
+  // Results that we've computed but haven't stored anywhere else yet, one
+  // buffer per iteration in progress. They're marked along with the view, so
+  // they survive collections that happen while we call back into Janet.
+  std::deque<std::vector<Janet>> scratch;
+} View;
+
+#define CAST_VIEW(expr) static_cast<View *>((expr))
+
+static int view_gc(void *data, size_t len) {
+  (void) len;
+  CAST_VIEW(data)->~View();
+  return 0;
+}
+
+static int view_gcmark(void *data, size_t len) {
+  (void) len;
+  auto view = CAST_VIEW(data);
+  janet_mark(view->source);
+  janet_mark(view->f);
+  janet_mark(view->realized);
+  for (auto pair : view->mapped) {
+    janet_mark(pair.second);
+  }
+  for (auto pair : view->filtered) {
+    janet_mark(pair.first);
+  }
+  for (const auto &buffer : view->scratch) {
+    for (auto value : buffer) {
+      janet_mark(value);
+    }
+  }
+  return 0;
+}
+
+static void view_tostring(void *data, JanetBuffer *buffer) {
+  auto view = CAST_VIEW(data);
+  janet_buffer_push_cstring(buffer, view->kind == VecMapView ? "map-view " : "filter-view ");
+  janet_pretty(buffer, 0, 0, view->source);
+}
+
+static Vec *view_source_vec(View *view) {
+  return CAST_VEC(janet_unwrap_abstract(view->source));
+}
+
+static Set *view_source_set(View *view) {
+  return CAST_SET(janet_unwrap_abstract(view->source));
+}
+
+// `el` is the element at `index` in the source vector.
+static Janet view_map_value(View *view, size_t index, Janet el) {
+  if (view->memoize) {
+    auto cached = view->mapped.find(index);
+    if (cached != view->mapped.end()) {
+      return cached->second;
+    }
+  }
+  Janet result = call_callable(view->f, 1, &el);
+  if (view->memoize) {
+    view->mapped[index] = result;
+  }
+  return result;
+}
+
+static Janet view_map_index(View *view, size_t index) {
+  if (!janet_checktype(view->realized, JANET_NIL)) {
+    return (*CAST_VEC(janet_unwrap_abstract(view->realized)))[index];
+  }
+  return view_map_value(view, index, (*view_source_vec(view))[index]);
+}
+
+static bool view_filter_accepts(View *view, Janet el) {
+  if (!janet_checktype(view->realized, JANET_NIL)) {
+    return CAST_SET(janet_unwrap_abstract(view->realized))->count(el) != 0;
+  }
+  if (view->memoize) {
+    auto cached = view->filtered.find(el);
+    if (cached != view->filtered.end()) {
+      return cached->second;
+    }
+  }
+  bool result = janet_truthy(call_callable(view->f, 1, &el));
+  if (view->memoize) {
+    view->filtered[el] = result;
+  }
+  return result;
+}
+
+// Moves an iterator over the source forward until it reaches an element that
+// passes the filter. Returns false if it reaches the end first.
+static bool view_filter_advance(View *view, Set::iterator &iterator) {
+  auto set = view_source_set(view);
+  while (iterator != set->end()) {
+    if (view_filter_accepts(view, *iterator)) {
+      return true;
+    }
+    iterator++;
+  }
+  return false;
+}
+
+static Janet cfun_view_length(int32_t argc, Janet *argv);
+
+static const JanetMethod view_methods[] = {
+  {"length", cfun_view_length},
+  {NULL, NULL}
+};
+
+static int view_get(void *data, Janet key, Janet *out) {
+  auto view = CAST_VIEW(data);
+  if (view->kind == VecMapView && janet_checksize(key)) {
+    size_t index = static_cast<size_t>(janet_unwrap_number(key));
+    if (index >= view_source_vec(view)->size()) {
+      return 0;
+    }
+    *out = view_map_index(view, index);
+    return 1;
+  } else if (view->kind == SetFilterView && janet_checkabstract(key, &set_iterator_type)) {
+    auto iterator = CAST_SET_ITERATOR(janet_unwrap_abstract(key));
+    check_set_iterator(janet_unwrap_abstract(view->source), iterator);
+    *out = *iterator->actual;
+    return 1;
+  } else if (janet_checktype(key, JANET_KEYWORD)) {
+    return janet_getmethod(janet_unwrap_keyword(key), view_methods, out);
+  } else {
+    return 0;
+  }
+}
+
+static Janet view_next(void *data, Janet key) {
+  auto view = CAST_VIEW(data);
+  if (view->kind == VecMapView) {
+    return vec_next(view_source_vec(view), key);
+  }
+  auto set = view_source_set(view);
+  if (janet_checktype(key, JANET_NIL)) {
+    // The filter can call back into Janet and trigger a collection, and
+    // nothing would mark a new iterator until we return it, so we find the
+    // first element before allocating one.
+    auto first = set->begin();
+    if (!view_filter_advance(view, first)) {
+      return janet_wrap_nil();
+    }
+    auto iterator = CAST_SET_ITERATOR(janet_abstract(&set_iterator_type, sizeof(SetIterator)));
+    iterator->backing_set = view->source;
+    iterator->actual = first;
+    return janet_wrap_abstract(iterator);
+  }
+  if (!janet_checkabstract(key, &set_iterator_type)) {
+    janet_panicf("view key should be an iterator; got %v", key);
+  }
+  auto iterator = CAST_SET_ITERATOR(janet_unwrap_abstract(key));
+  check_set_iterator(set, iterator);
+  iterator->actual++;
+  return view_filter_advance(view, iterator->actual) ? key : janet_wrap_nil();
+}
+
+static Janet view_call(void *data, int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto view = CAST_VIEW(data);
+  if (view->kind == SetFilterView) {
+    return janet_wrap_boolean(view_source_set(view)->count(argv[0]) && view_filter_accepts(view, argv[0]));
+  }
+  size_t index = janet_getsize(argv, 0);
+  auto size = view_source_vec(view)->size();
+  if (index >= size) {
+    janet_panicf("expected integer key in range [0, %d), got %v", size, argv[0]);
+  }
+  return view_map_index(view, index);
+}
+
+static const JanetAbstractType view_type = {
+  .name = "jimmy/view",
+  .gc = view_gc,
+  .gcmark = view_gcmark,
+  .get = view_get,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = view_tostring,
+  .compare = NULL,
+  .hash = NULL,
+  .next = view_next,
+  .call = view_call,
+};
+
+static View *view_get_kind(Janet *argv, int32_t n, ViewKind kind) {
+  auto view = CAST_VIEW(janet_getabstract(argv, n, &view_type));
+  if (view->kind != kind) {
+    janet_panicf("bad slot #%d, expected %s, got %v", n,
+      kind == VecMapView ? "map view" : "filter view", argv[n]);
+  }
+  return view;
+}
+
+static Janet view_new(ViewKind kind, int32_t argc, Janet *argv) {
+  auto view = new (janet_abstract(&view_type, sizeof(View))) View();
+  view->kind = kind;
+  view->source = argv[0];
+  view->f = argv[1];
+  view->realized = janet_wrap_nil();
+  view->memoize = argc > 2 && janet_truthy(argv[2]);
+  return janet_wrap_abstract(view);
+}
+
+static Janet cfun_view_vec_map(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+  janet_getabstract(argv, 0, &vec_type);
+  return view_new(VecMapView, argc, argv);
+}
+
+static Janet cfun_view_set_filter(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 3);
+  janet_getabstract(argv, 0, &set_type);
+  return view_new(SetFilterView, argc, argv);
+}
+
+// Gives `fn` a buffer of its own in the view's scratch space, so that a
+// callback can iterate the same view again without clobbering a chunk that
+// it was given. Growing a deque at the end doesn't move its other elements.
+template <typename Fn>
+static void view_with_buffer(View *view, Fn &&fn) {
+  view->scratch.emplace_back();
+  auto &buffer = view->scratch.back();
+  with_cleanup([&]() { fn(buffer); }, [&]() { view->scratch.pop_back(); });
+}
+
+// Appends the mapped values of the source elements from `first` to `last`,
+// the first of which is at `*index`.
+static void view_map_range(View *view, size_t *index, const Janet *first, const Janet *last, std::vector<Janet> &buffer) {
+  for (; first != last; first++) {
+    buffer.push_back(view_map_value(view, (*index)++, *first));
+  }
+}
+
+// Calls `fn` with each chunk of the view. A chunk of a map view is every
+// element under one leaf of the source vector, and a chunk of a filter view
+// is every element of one node of the source set that passes the filter,
+// skipping nodes where nothing does. Realized views iterate the realized
+// collection instead.
+template <typename Fn>
+static void view_each_chunk(View *view, Fn &&fn) {
+  if (!janet_checktype(view->realized, JANET_NIL)) {
+    auto realized = janet_unwrap_abstract(view->realized);
+    if (view->kind == VecMapView) {
+      immer::for_each_chunk(*CAST_VEC(realized), fn);
+    } else {
+      immer::for_each_chunk(*CAST_SET(realized), fn);
+    }
+    return;
+  }
+  view_with_buffer(view, [&](std::vector<Janet> &buffer) {
+    if (view->kind == VecMapView) {
+      size_t index = 0;
+      immer::for_each_chunk(*view_source_vec(view), [&](const Janet *first, const Janet *last) {
+        buffer.clear();
+        view_map_range(view, &index, first, last, buffer);
+        fn(buffer.data(), buffer.data() + buffer.size());
+      });
+    } else {
+      immer::for_each_chunk(*view_source_set(view), [&](const Janet *first, const Janet *last) {
+        buffer.clear();
+        for (; first != last; first++) {
+          if (view_filter_accepts(view, *first)) {
+            buffer.push_back(*first);
+          }
+        }
+        if (!buffer.empty()) {
+          fn(buffer.data(), buffer.data() + buffer.size());
+        }
+      });
+    }
+  });
+}
+
+// Called by vec/each, vec/each-chunk, set/each and set/each-chunk. Returns
+// false if `value` isn't a view over a collection of `source_type`, so that
+// the caller can treat it as a regular collection.
+static bool view_each(Janet value, const JanetAbstractType *source_type, Janet f, bool chunked) {
+  if (!janet_checkabstract(value, &view_type)) {
+    return false;
+  }
+  auto view = CAST_VIEW(janet_unwrap_abstract(value));
+  if (!janet_checkabstract(view->source, source_type)) {
+    return false;
+  }
+  view_each_chunk(view, [&](const Janet *first, const Janet *last) {
+    if (chunked) {
+      Janet tuple = janet_wrap_tuple(janet_tuple_n(first, static_cast<int32_t>(last - first)));
+      call_callable(f, 1, &tuple);
+    } else {
+      for (; first != last; first++) {
+        Janet el = *first;
+        call_callable(f, 1, &el);
+      }
+    }
+  });
+  return true;
+}
+
+static Janet cfun_view_vec_realize(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto view = view_get_kind(argv, 0, VecMapView);
+  if (janet_checktype(view->realized, JANET_NIL)) {
+    view_with_buffer(view, [&](std::vector<Janet> &buffer) {
+      size_t index = 0;
+      immer::for_each_chunk(*view_source_vec(view), [&](const Janet *first, const Janet *last) {
+        view_map_range(view, &index, first, last, buffer);
+      });
+      auto vec = NEW_VEC();
+      auto transient = vec->transient();
+      for (auto el : buffer) {
+        transient.push_back(el);
+      }
+      *vec = transient.persistent();
+      view->realized = janet_wrap_abstract(vec);
+    });
+    view->mapped.clear();
+  }
+  return view->realized;
+}
+
+static Janet cfun_view_set_realize(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto view = view_get_kind(argv, 0, SetFilterView);
+  if (janet_checktype(view->realized, JANET_NIL)) {
+    auto source = view_source_set(view);
+    auto set = NEW_SET();
+    auto transient = NEW_TSET();
+    *transient = set->transient();
+    for (auto el : *source) {
+      if (view_filter_accepts(view, el)) {
+        transient->insert(el);
+      }
+    }
+    *set = transient->persistent();
+    view->realized = janet_wrap_abstract(set);
+    view->filtered.clear();
+  }
+  return view->realized;
+}
+
+// Filter views don't know their length until every element has been tested,
+// so asking for it evaluates the predicate on the whole set.
+static Janet cfun_view_length(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  auto view = CAST_VIEW(janet_unwrap_abstract(argv[0]));
+  if (view->kind == VecMapView) {
+    return janet_wrap_number(static_cast<double>(view_source_vec(view)->size()));
+  }
+  if (janet_checktype(view->realized, JANET_NIL)) {
+    cfun_view_set_realize(1, argv);
+  }
+  return janet_wrap_integer(static_cast<int32_t>(CAST_SET(janet_unwrap_abstract(view->realized))->size()));
+}
+
+static const JanetReg view_cfuns[] = {
+  {"vec/map-view", cfun_view_vec_map, "(vec/map-view vec f &opt memoize)\n\n"
+    "Returns a lazy view of `(vec/map vec f)` in constant time. `f` only runs on the elements that you "
+    "actually read, by indexing, iteration, `vec/each` or `vec/each-chunk`. If `memoize` is truthy, "
+    "the view remembers every result, so `f` runs at most once per element. "
+    "`f` can be any callable value, not just a function."},
+  {"vec/realize", cfun_view_vec_realize, "(vec/realize view)\n\n"
+    "Returns a vector of every element of a map view. "
+    "After this, the view reads from that vector instead of calling `f` again."},
+  {"set/filter-view", cfun_view_set_filter, "(set/filter-view set pred &opt memoize)\n\n"
+    "Returns a lazy view of `(set/filter set pred)` in constant time. `pred` only runs on the elements "
+    "that you actually test or iterate over, by calling the view, iteration, `set/each` or `set/each-chunk`. If `memoize` is truthy, the view remembers every result, "
+    "so `pred` runs at most once per element. Taking the `length` of a filter view realizes it.\n\n"
+    "`pred` can be any callable value, not just a function."},
+  {"set/realize", cfun_view_set_realize, "(set/realize view)\n\n"
+    "Returns a set of every element of a filter view. "
+    "After this, the view reads from that set instead of calling `pred` again."},
+  {NULL, NULL, NULL}
+};
@@ -0,0 +1,316 @@
+#include <vector>
+
+// Transducers: each step transforms a stream of values, and `xf/into` pushes
+// every value of a source through all of the steps in a single pass, writing
+// the survivors straight into one destination transient. No intermediate
+// collections are ever built.
+
+typedef enum {
+  XfMap,
+  XfFilter,
+  XfTakeWhile,
+  XfMapcat,
+  XfDedupe,
+} XfKind;
+
+typedef struct {
+  XfKind kind;
+  Janet f;
+} XfStep;
+
+#define CAST_XF_STEP(expr) static_cast<XfStep *>((expr))
+
+static int xf_step_gcmark(void *data, size_t len) {
+  (void) len;
+  janet_mark(CAST_XF_STEP(data)->f);
+  return 0;
+}
+
+static void xf_step_tostring(void *data, JanetBuffer *buffer) {
+  switch (CAST_XF_STEP(data)->kind) {
+  case XfMap: janet_buffer_push_cstring(buffer, "map"); break;
+  case XfFilter: janet_buffer_push_cstring(buffer, "filter"); break;
+  case XfTakeWhile: janet_buffer_push_cstring(buffer, "take-while"); break;
+  case XfMapcat: janet_buffer_push_cstring(buffer, "mapcat"); break;
+  case XfDedupe: janet_buffer_push_cstring(buffer, "dedupe"); break;
+  }
+}
+
+static const JanetAbstractType xf_step_type = {
+  .name = "jimmy/xf",
+  .gc = NULL,
+  .gcmark = xf_step_gcmark,
+  .get = NULL,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = xf_step_tostring,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+// The state of a single `xf/into` call. The values that the steps produce
+// don't live anywhere else, so the run marks them itself, and stays rooted
+// for as long as it might call back into Janet. It's unrooted even if a step
+// panics, so the GC can free everything it holds.
+typedef struct {
+  const JanetAbstractType *destination_type;
+  TVec vec;
+  TSet set;
+  TMap map;
+  std::vector<XfStep *> steps;
+  std::vector<Janet> previous;
+  std::vector<bool> has_previous;
+} XfRun;
+
+#define CAST_XF_RUN(expr) static_cast<XfRun *>((expr))
+
+static int xf_run_gc(void *data, size_t len) {
+  (void) len;
+  CAST_XF_RUN(data)->~XfRun();
+  return 0;
+}
+
+static int xf_run_gcmark(void *data, size_t len) {
+  (void) len;
+  auto run = CAST_XF_RUN(data);
+  for (auto value : run->previous) {
+    janet_mark(value);
+  }
+  // The destination transient starts out sharing every node with the
+  // collection we're adding to, which marks them too, so we mark by node.
+  if (run->destination_type == &vec_type) {
+    mark_vector_transient(run->vec);
+  } else if (run->destination_type == &set_type) {
+    mark_champ_transient(run->set, [](const Janet &el) {
+      janet_mark(el);
+    });
+  } else {
+    mark_champ_transient(run->map, [](const std::pair<Janet, Janet> &pair) {
+      janet_mark(pair.first);
+      janet_mark(pair.second);
+    });
+  }
+  return 0;
+}
+
+// The xf-run abstract type is not exposed to the user.
+static const JanetAbstractType xf_run_type = {
+  .name = "jimmy/xf-run",
+  .gc = xf_run_gc,
+  .gcmark = xf_run_gcmark,
+  .get = NULL,
+  .put = NULL,
+  .marshal = NULL,
+  .unmarshal = NULL,
+  .tostring = NULL,
+  .compare = NULL,
+  .hash = NULL,
+  .next = NULL,
+  .call = NULL,
+};
+
+static void xf_emit(XfRun *run, Janet value) {
+  if (run->destination_type == &vec_type) {
+    run->vec.push_back(value);
+  } else if (run->destination_type == &set_type) {
+    run->set.insert(value);
+  } else {
+    const Janet *pair;
+    int32_t length;
+    if (!janet_indexed_view(value, &pair, &length) || length != 2) {
+      janet_panicf("expected a key-value pair, got %v", value);
+    }
+    run->map.set(pair[0], pair[1]);
+  }
+}
+
+// Pushes a value through the steps starting at `i`. Returns false once a step
+// has decided that no more values should be produced.
+static bool xf_push(XfRun *run, size_t i, Janet value) {
+  for (; i < run->steps.size(); i++) {
+    auto step = run->steps[i];
+    switch (step->kind) {
+    case XfMap:
+      value = call_callable(step->f, 1, &value);
+      break;
+    case XfFilter:
+      if (!janet_truthy(call_callable(step->f, 1, &value))) {
+        return true;
+      }
+      break;
+    case XfTakeWhile:
+      if (!janet_truthy(call_callable(step->f, 1, &value))) {
+        return false;
+      }
+      break;
+    case XfMapcat: {
+      Janet iterable = call_callable(step->f, 1, &value);
+      Janet key = janet_wrap_nil();
+      while (true) {
+        key = janet_next(iterable, key);
+        if (janet_checktype(key, JANET_NIL)) {
+          return true;
+        }
+        if (!xf_push(run, i + 1, janet_in(iterable, key))) {
+          return false;
+        }
+      }
+    }
+    case XfDedupe:
+      if (run->has_previous[i] && janet_equals(run->previous[i], value)) {
+        return true;
+      }
+      run->previous[i] = value;
+      run->has_previous[i] = true;
+      break;
+    }
+  }
+  xf_emit(run, value);
+  return true;
+}
+
+static void xf_push_all(XfRun *run, Janet source) {
+  if (janet_checkabstract(source, &vec_type)) {
+    for (auto el : *CAST_VEC(janet_unwrap_abstract(source))) {
+      if (!xf_push(run, 0, el)) {
+        return;
+      }
+    }
+  } else if (janet_checkabstract(source, &set_type)) {
+    for (auto el : *CAST_SET(janet_unwrap_abstract(source))) {
+      if (!xf_push(run, 0, el)) {
+        return;
+      }
+    }
+  } else if (janet_checkabstract(source, &map_type)) {
+    for (auto pair : *CAST_MAP(janet_unwrap_abstract(source))) {
+      if (!xf_push(run, 0, pair_to_tuple(pair))) {
+        return;
+      }
+    }
+  } else {
+    Janet key = janet_wrap_nil();
+    while (true) {
+      key = janet_next(source, key);
+      if (janet_checktype(key, JANET_NIL)) {
+        return;
+      }
+      if (!xf_push(run, 0, janet_in(source, key))) {
+        return;
+      }
+    }
+  }
+}
+
+static Janet cfun_xf_into(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, -1);
+  Janet destination = argv[0];
+  const JanetAbstractType *destination_type;
+  if (janet_checkabstract(destination, &vec_type)) {
+    destination_type = &vec_type;
+  } else if (janet_checkabstract(destination, &set_type)) {
+    destination_type = &set_type;
+  } else if (janet_checkabstract(destination, &map_type)) {
+    destination_type = &map_type;
+  } else {
+    janet_panicf("bad slot #0, expected jimmy/vec, jimmy/set or jimmy/map, got %v", destination);
+  }
+  for (int32_t i = 2; i < argc; i++) {
+    janet_getabstract(argv, i, &xf_step_type);
+  }
+
+  auto run = new (janet_abstract(&xf_run_type, sizeof(XfRun))) XfRun();
+  Janet run_value = janet_wrap_abstract(run);
+  janet_gcroot(run_value);
+  run->destination_type = destination_type;
+  if (destination_type == &vec_type) {
+    run->vec = CAST_VEC(janet_unwrap_abstract(destination))->transient();
+  } else if (destination_type == &set_type) {
+    run->set = CAST_SET(janet_unwrap_abstract(destination))->transient();
+  } else {
+    run->map = CAST_MAP(janet_unwrap_abstract(destination))->transient();
+  }
+  for (int32_t i = 2; i < argc; i++) {
+    run->steps.push_back(CAST_XF_STEP(janet_unwrap_abstract(argv[i])));
+  }
+  run->previous.resize(run->steps.size(), janet_wrap_nil());
+  run->has_previous.resize(run->steps.size(), false);
+
+  with_cleanup([&]() { xf_push_all(run, argv[1]); }, [&]() { janet_gcunroot(run_value); });
+
+  Janet result;
+  if (destination_type == &vec_type) {
+    auto vec = NEW_VEC();
+    *vec = run->vec.persistent();
+    result = janet_wrap_abstract(vec);
+  } else if (destination_type == &set_type) {
+    auto set = NEW_SET();
+    *set = run->set.persistent();
+    result = janet_wrap_abstract(set);
+  } else {
+    auto map = NEW_MAP();
+    *map = run->map.persistent();
+    result = janet_wrap_abstract(map);
+  }
+  return result;
+}
+
+static Janet xf_new_step(XfKind kind, Janet f) {
+  auto step = CAST_XF_STEP(janet_abstract(&xf_step_type, sizeof(XfStep)));
+  step->kind = kind;
+  step->f = f;
+  return janet_wrap_abstract(step);
+}
+
+static Janet cfun_xf_map(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return xf_new_step(XfMap, argv[0]);
+}
+
+static Janet cfun_xf_filter(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return xf_new_step(XfFilter, argv[0]);
+}
+
+static Janet cfun_xf_take_while(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return xf_new_step(XfTakeWhile, argv[0]);
+}
+
+static Janet cfun_xf_mapcat(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  return xf_new_step(XfMapcat, argv[0]);
+}
+
+static Janet cfun_xf_dedupe(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 0);
+  (void) argv;
+  return xf_new_step(XfDedupe, janet_wrap_nil());
+}
+
+static const JanetReg xf_cfuns[] = {
+  {"xf/into", cfun_xf_into, "(xf/into destination source & steps)\n\n"
+    "Passes every value of `source` through each of the `steps` in turn, and returns a new collection "
+    "like `destination` with every value that makes it out the other end added to it. "
+    "`destination` can be a vec, a set or a map; for a map, the values must be key-value pairs. "
+    "`source` can be any iterable data structure.\n\n"
+    "The values stream through all of the steps in a single pass, without building any intermediate collections."},
+  {"xf/map", cfun_xf_map, "(xf/map f)\n\n"
+    "Returns a step that replaces every value with `(f value)`. "
+    "`f` can be any callable value, not just a function."},
+  {"xf/filter", cfun_xf_filter, "(xf/filter pred)\n\n"
+    "Returns a step that only passes along values for which the predicate returns a truthy value. "
+    "`pred` can be any callable value, not just a function."},
+  {"xf/take-while", cfun_xf_take_while, "(xf/take-while pred)\n\n"
+    "Returns a step that passes along values until the predicate returns a falsey value, "
+    "and then stops the whole pipeline. `pred` can be any callable value, not just a function."},
+  {"xf/mapcat", cfun_xf_mapcat, "(xf/mapcat f)\n\n"
+    "Returns a step that passes along every value of the iterable `(f value)`. "
+    "`f` can be any callable value, not just a function."},
+  {"xf/dedupe", cfun_xf_dedupe, "(xf/dedupe)\n\n"
+    "Returns a step that skips values that are equal to the value immediately before them."},
+  {NULL, NULL, NULL}
+};